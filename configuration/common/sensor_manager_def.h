@@ -1,6 +1,8 @@
 #include <caf/sensor_manager.h>
 #include <zephyr/drivers/sensor/ams_as5600.h>
 
+#include "scroller_config.h"
+
 #define STEP_SENSOR DT_NODELABEL(as5600)
 
 static const struct caf_sampled_channel step_channel[] = {
@@ -12,11 +14,22 @@ static const struct caf_sampled_channel step_channel[] = {
 static const struct sm_sensor_config sensor_configs[] = {
     {
         .dev = DEVICE_DT_GET(STEP_SENSOR),
-        .event_descr = "step",
+        .event_descr = SCROLLER_WHEEL_SENSOR_DESCR,
+        .chans = step_channel,
+        .chan_cnt = ARRAY_SIZE(step_channel),
+        .sampling_period_ms = 5,
+        .active_events_limit = 3,
+        .suspend = false,
+    },
+#if SCROLLER_HAS_PAN
+    {
+        .dev = DEVICE_DT_GET(SCROLLER_PAN_NODE),
+        .event_descr = SCROLLER_PAN_SENSOR_DESCR,
         .chans = step_channel,
         .chan_cnt = ARRAY_SIZE(step_channel),
         .sampling_period_ms = 5,
         .active_events_limit = 3,
         .suspend = false,
     },
+#endif
 };
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Generate the fixed point scroll acceleration gain table for a profile.
+
+The gain curve is evaluated in floating point at build time and written as a Q8 lookup
+table, so the firmware only does integer interpolation on the hot path.
+
+gain(v) = low + (high - low) * clamp((v - start) / (end - start), 0, 1) ** exponent
+
+with v the wheel velocity in sensor counts per 100 ms.
+"""
+
+import argparse
+import pathlib
+
+# Table layout, shared with struct scroll_accel_curve
+ENTRIES = 65
+VELOCITY_STEP = 8  # counts per 100 ms between entries
+Q = 8
+
+# name: (low gain, high gain, start velocity, end velocity, exponent)
+PROFILES = {
+    "gentle": (1.0, 2.0, 40, 400, 1.0),
+    "classic": (1.0, 4.0, 24, 320, 1.0),
+    "steep": (1.0, 8.0, 16, 480, 2.0),
+}
+
+
+def gain(profile, velocity):
+    low, high, start, end, exponent = PROFILES[profile]
+    t = min(max((velocity - start) / (end - start), 0.0), 1.0)
+    return low + (high - low) * t**exponent
+
+
+def table(profile):
+    values = [round(gain(profile, i * VELOCITY_STEP) * (1 << Q)) for i in range(ENTRIES)]
+    rows = [", ".join(f"{v:5d}" for v in values[i : i + 8]) for i in range(0, ENTRIES, 8)]
+    return "".join(f"    {row},\n" for row in rows)
+
+
+def write_all(output):
+    """Every profile, for host tools that pick one at runtime"""
+    output.write_text(
+        "/* Generated by scripts/gen_accel_lut.py, do not edit */\n"
+        "#ifndef SCROLLER_ACCEL_PROFILES_H\n"
+        "#define SCROLLER_ACCEL_PROFILES_H\n\n"
+        "#include <stdint.h>\n\n"
+        f"#define SCROLLER_ACCEL_LUT_ENTRIES {ENTRIES}\n"
+        f"#define SCROLLER_ACCEL_LUT_VELOCITY_STEP {VELOCITY_STEP}\n\n"
+        "static const struct\n{\n"
+        "    const char *name;\n"
+        f"    uint16_t gain_q{Q}[{ENTRIES}];\n"
+        "} scroller_accel_profiles[] = {\n"
+        + "".join(f'    {{"{name}", {{\n{table(name)}    }}}},\n' for name in sorted(PROFILES))
+        + "};\n\n"
+        "#endif /* SCROLLER_ACCEL_PROFILES_H */\n"
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    group = parser.add_mutually_exclusive_group(required=True)
+    group.add_argument("--profile", choices=sorted(PROFILES))
+    group.add_argument("--all", action="store_true", help="write every profile")
+    parser.add_argument("--output", required=True, type=pathlib.Path)
+    args = parser.parse_args()
+
+    args.output.parent.mkdir(parents=True, exist_ok=True)
+
+    if args.all:
+        write_all(args.output)
+        return
+
+    args.output.write_text(
+        "/* Generated by scripts/gen_accel_lut.py, do not edit */\n"
+        "#ifndef SCROLLER_ACCEL_LUT_H\n"
+        "#define SCROLLER_ACCEL_LUT_H\n\n"
+        "#include <stdint.h>\n\n"
+        f'#define SCROLLER_ACCEL_LUT_PROFILE "{args.profile}"\n'
+        f"#define SCROLLER_ACCEL_LUT_VELOCITY_STEP {VELOCITY_STEP}\n\n"
+        f"/* Q{Q} gain per {VELOCITY_STEP} counts per 100 ms of velocity */\n"
+        f"static const uint16_t scroller_accel_lut[{ENTRIES}] = {{\n"
+        + table(args.profile)
+        + "};\n\n"
+        "#endif /* SCROLLER_ACCEL_LUT_H */\n"
+    )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Decode the Scroller raw angle trace into CSV.
+
+Reads the frame stream described in src/modules/scroller_trace.h from the trace CDC ACM
+port or a captured file and writes one CSV row per sample:
+
+    time_us,axis,angle,steps
+
+Frames lost on the device are reported on stderr with the number of dropped records,
+as are bytes skipped while resynchronizing on the frame magic.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import termios
+import tty
+
+FRAME_MAGIC = 0xA5
+HEADER = struct.Struct("<BBBBHIHH")
+COUNTS = 4096
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode_frame(header, payload):
+    """Rows of a frame, only returned once the whole payload checks out."""
+    _, _, _, count, _, time_us, *angles = header
+    rows = []
+    pos = 0
+    for _ in range(count):
+        tagged, pos = read_varint(payload, pos)
+        change, pos = read_varint(payload, pos)
+        steps, pos = read_varint(payload, pos)
+
+        axis = tagged & 1
+        time_us += tagged >> 1
+        angles[axis] = (angles[axis] + unzigzag(change)) % COUNTS
+        rows.append(f"{time_us},{axis},{angles[axis]},{unzigzag(steps)}\n")
+
+    if pos != len(payload):
+        raise ValueError("record count doesn't match the payload")
+
+    return rows
+
+
+def decode(stream, writer):
+    buf = bytearray()
+    expected_seq = None
+    frames = dropped = skipped = 0
+
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            break
+        buf += chunk
+
+        while True:
+            start = buf.find(FRAME_MAGIC)
+            if start < 0:
+                skipped += len(buf)
+                buf.clear()
+                break
+            skipped += start
+            del buf[:start]
+
+            if len(buf) < HEADER.size:
+                break
+            header = HEADER.unpack_from(buf)
+            length = header[1]
+            if len(buf) < HEADER.size + length:
+                break
+
+            payload = bytes(buf[HEADER.size:HEADER.size + length])
+            try:
+                rows = decode_frame(header, payload)
+            except (IndexError, ValueError):
+                # False magic inside a frame, move past it
+                skipped += 1
+                del buf[:1]
+                continue
+            writer.writelines(rows)
+
+            seq, lost = header[2], header[4]
+            if lost:
+                dropped += lost
+                print(f"trace overflow: {lost} records dropped before frame {seq}", file=sys.stderr)
+            if expected_seq is not None and seq != expected_seq:
+                print(f"frame sequence gap: expected {expected_seq}, got {seq}", file=sys.stderr)
+            expected_seq = (seq + 1) & 0xFF
+            frames += 1
+            del buf[:HEADER.size + length]
+
+        writer.flush()
+
+    print(f"{frames} frames, {dropped} records dropped, {skipped} bytes skipped", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="trace port, e.g. /dev/ttyACM1, or a captured file")
+    parser.add_argument("-o", "--output", help="CSV file, stdout by default")
+    args = parser.parse_args()
+
+    writer = open(args.output, "w") if args.output else sys.stdout
+    writer.write("time_us,axis,angle,steps\n")
+
+    # Opening a tty asserts DTR, which starts the capture on the device
+    with open(args.input, "rb", buffering=0) as stream:
+        fd = stream.fileno()
+        saved = None
+        if os.isatty(fd):
+            # The stream is binary: no line editing, CR/LF translation, flow control, signal
+            # characters or echo back to the device
+            saved = termios.tcgetattr(fd)
+            tty.setraw(fd)
+        try:
+            decode(stream, writer)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            if saved is not None:
+                termios.tcsetattr(fd, termios.TCSANOW, saved)
+
+
+if __name__ == "__main__":
+    main()
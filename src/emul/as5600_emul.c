@@ -0,0 +1,407 @@
+#define DT_DRV_COMPAT ams_as5600
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/i2c_emul.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(as5600_emul, LOG_LEVEL_INF);
+
+#include "as5600_emul.h"
+
+/* AS5600 register map */
+#define AS5600_REG_CONF_H 0x07
+#define AS5600_REG_STATUS 0x0B
+#define AS5600_REG_RAW_ANGLE_H 0x0C
+#define AS5600_REG_RAW_ANGLE_L 0x0D
+#define AS5600_REG_ANGLE_H 0x0E
+#define AS5600_REG_ANGLE_L 0x0F
+#define AS5600_REG_AGC 0x1A
+#define AS5600_REG_MAGNITUDE_H 0x1B
+#define AS5600_REG_MAGNITUDE_L 0x1C
+#define AS5600_REG_COUNT 0x100
+
+/* Magnet detected, neither too weak nor too strong */
+#define AS5600_STATUS_MD 0x20
+
+/* Default waveform: spin forward, rest, flick backwards, rest */
+static const struct as5600_emul_segment default_waveform[] = {
+    {.velocity = 2048, .duration_ms = 2000},
+    {.velocity = 0, .duration_ms = 1000},
+    {.velocity = -8192, .duration_ms = 250},
+    {.velocity = 0, .duration_ms = 1000},
+};
+
+struct as5600_emul_data
+{
+    uint8_t regs[AS5600_REG_COUNT];
+    /* Register address pointer, set by the first byte of a write */
+    uint8_t reg_ptr;
+
+    /* Scripted waveform */
+    const struct as5600_emul_segment *segments;
+    size_t segment_count;
+    bool repeat;
+    /* Start of the waveform */
+    int64_t start_us;
+    /* Angle at the start of the waveform */
+    uint16_t start_angle;
+
+    /* Injected faults left, the error they fail with and the transfers failed so far */
+    uint32_t faults;
+    int fault_err;
+    uint32_t faults_served;
+
+    /* Delayed transfers left and the time each takes */
+    uint32_t delays;
+    uint32_t delay_us;
+
+    struct k_spinlock lock;
+};
+
+struct as5600_emul_cfg
+{
+    uint16_t addr;
+    uint8_t index;
+};
+
+/* Emulators by instance, for the shell */
+static const struct emul *instances[DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT)];
+
+/* Integrate the waveform up to the current time */
+static uint16_t waveform_angle(struct as5600_emul_data *data)
+{
+    int64_t elapsed_us = k_ticks_to_us_floor64(k_uptime_ticks()) - data->start_us;
+    int64_t total_us = 0;
+    int64_t position = data->start_angle;
+
+    for (size_t i = 0; i < data->segment_count; i++)
+    {
+        total_us += (int64_t)data->segments[i].duration_ms * USEC_PER_MSEC;
+    }
+
+    if (data->repeat && total_us > 0)
+    {
+        /* Full repetitions move the same distance each time */
+        int64_t repetitions = elapsed_us / total_us;
+
+        for (size_t i = 0; i < data->segment_count; i++)
+        {
+            position += repetitions * data->segments[i].velocity * data->segments[i].duration_ms / MSEC_PER_SEC;
+        }
+        elapsed_us %= total_us;
+    }
+
+    for (size_t i = 0; i < data->segment_count && elapsed_us > 0; i++)
+    {
+        int64_t segment_us = (int64_t)data->segments[i].duration_ms * USEC_PER_MSEC;
+        int64_t dt_us = MIN(elapsed_us, segment_us);
+
+        position += data->segments[i].velocity * dt_us / USEC_PER_SEC;
+        elapsed_us -= dt_us;
+    }
+
+    /* Wrap into 0-4095, position may be negative */
+    position %= AS5600_EMUL_COUNTS;
+    if (position < 0)
+    {
+        position += AS5600_EMUL_COUNTS;
+    }
+
+    return (uint16_t)position;
+}
+
+/* Refresh the angle registers before they are read */
+static void update_angle_regs(struct as5600_emul_data *data)
+{
+    uint16_t angle = waveform_angle(data);
+
+    data->regs[AS5600_REG_RAW_ANGLE_H] = angle >> 8;
+    data->regs[AS5600_REG_RAW_ANGLE_L] = angle & 0xFF;
+    data->regs[AS5600_REG_ANGLE_H] = angle >> 8;
+    data->regs[AS5600_REG_ANGLE_L] = angle & 0xFF;
+}
+
+static int as5600_emul_transfer(const struct emul *target, struct i2c_msg *msgs, int num_msgs, int addr)
+{
+    struct as5600_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    if (data->delays)
+    {
+        uint32_t delay_us = data->delay_us;
+
+        data->delays--;
+        k_spin_unlock(&data->lock, key);
+        /* Holds the caller, the RTIO work queue for reads submitted through RTIO */
+        k_sleep(K_USEC(delay_us));
+        key = k_spin_lock(&data->lock);
+    }
+
+    if (data->faults)
+    {
+        int err = data->fault_err;
+
+        if (data->faults != AS5600_EMUL_FAULT_STUCK)
+        {
+            data->faults--;
+        }
+        data->faults_served++;
+        k_spin_unlock(&data->lock, key);
+
+        return err;
+    }
+
+    for (int i = 0; i < num_msgs; i++)
+    {
+        struct i2c_msg *msg = &msgs[i];
+
+        if (msg->flags & I2C_MSG_READ)
+        {
+            update_angle_regs(data);
+
+            for (uint32_t j = 0; j < msg->len; j++)
+            {
+                msg->buf[j] = data->regs[data->reg_ptr++];
+            }
+        }
+        else
+        {
+            if (msg->len == 0)
+            {
+                continue;
+            }
+
+            /* First byte is the register address, any following bytes are written */
+            data->reg_ptr = msg->buf[0];
+            for (uint32_t j = 1; j < msg->len; j++)
+            {
+                data->regs[data->reg_ptr++] = msg->buf[j];
+            }
+        }
+    }
+
+    k_spin_unlock(&data->lock, key);
+
+    return 0;
+}
+
+static const struct i2c_emul_api as5600_emul_api_i2c = {
+    .transfer = as5600_emul_transfer,
+};
+
+void as5600_emul_set_waveform(const struct emul *target, const struct as5600_emul_segment *segments,
+                              size_t count, bool repeat)
+{
+    struct as5600_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    /* Continue from wherever the previous waveform left the wheel */
+    data->start_angle = waveform_angle(data);
+    data->start_us = k_ticks_to_us_floor64(k_uptime_ticks());
+    data->segments = segments;
+    data->segment_count = count;
+    data->repeat = repeat;
+
+    k_spin_unlock(&data->lock, key);
+}
+
+void as5600_emul_set_angle(const struct emul *target, uint16_t angle)
+{
+    struct as5600_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    data->start_angle = angle % AS5600_EMUL_COUNTS;
+    data->start_us = k_ticks_to_us_floor64(k_uptime_ticks());
+    data->segments = NULL;
+    data->segment_count = 0;
+    data->repeat = false;
+
+    k_spin_unlock(&data->lock, key);
+}
+
+uint16_t as5600_emul_get_angle(const struct emul *target)
+{
+    struct as5600_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+    uint16_t angle = waveform_angle(data);
+
+    k_spin_unlock(&data->lock, key);
+
+    return angle;
+}
+
+void as5600_emul_inject_faults(const struct emul *target, uint32_t count, int err)
+{
+    struct as5600_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    data->faults = count;
+    data->fault_err = err;
+
+    k_spin_unlock(&data->lock, key);
+}
+
+void as5600_emul_inject_delay(const struct emul *target, uint32_t count, uint32_t delay_us)
+{
+    struct as5600_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    data->delays = count;
+    data->delay_us = delay_us;
+
+    k_spin_unlock(&data->lock, key);
+}
+
+uint32_t as5600_emul_faults_served(const struct emul *target)
+{
+    struct as5600_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+    uint32_t served = data->faults_served;
+
+    k_spin_unlock(&data->lock, key);
+
+    return served;
+}
+
+static int as5600_emul_init(const struct emul *target, const struct device *parent)
+{
+    struct as5600_emul_data *data = target->data;
+
+    ARG_UNUSED(parent);
+
+    memset(data->regs, 0, sizeof(data->regs));
+    data->regs[AS5600_REG_STATUS] = AS5600_STATUS_MD;
+    data->regs[AS5600_REG_AGC] = 0x80;
+    data->regs[AS5600_REG_MAGNITUDE_H] = 0x08;
+
+    data->start_angle = 0;
+    data->start_us = 0;
+    data->segments = default_waveform;
+    data->segment_count = ARRAY_SIZE(default_waveform);
+    data->repeat = true;
+    data->faults = 0;
+    data->faults_served = 0;
+    data->delays = 0;
+
+    instances[((const struct as5600_emul_cfg *)target->cfg)->index] = target;
+
+    LOG_INF("AS5600 emulator at 0x%02x", ((const struct as5600_emul_cfg *)target->cfg)->addr);
+
+    return 0;
+}
+
+#define AS5600_EMUL(n)                                                                \
+    static struct as5600_emul_data as5600_emul_data_##n;                              \
+    static const struct as5600_emul_cfg as5600_emul_cfg_##n = {                       \
+        .addr = DT_INST_REG_ADDR(n),                                                  \
+        .index = n,                                                                   \
+    };                                                                                \
+    EMUL_DT_INST_DEFINE(n, as5600_emul_init, &as5600_emul_data_##n, &as5600_emul_cfg_##n, \
+                        &as5600_emul_api_i2c, NULL)
+
+DT_INST_FOREACH_STATUS_OKAY(AS5600_EMUL)
+
+#ifdef CONFIG_SHELL
+static int parse_instance(const struct shell *sh, const char *arg, const struct emul **target)
+{
+    int err = 0;
+    unsigned long index = shell_strtoul(arg, 10, &err);
+
+    if (err || index >= ARRAY_SIZE(instances) || instances[index] == NULL)
+    {
+        shell_error(sh, "Expected a sensor from 0 to %u: %s", (unsigned int)ARRAY_SIZE(instances) - 1, arg);
+        return -EINVAL;
+    }
+
+    *target = instances[index];
+
+    return 0;
+}
+
+static int cmd_fault(const struct shell *sh, size_t argc, char **argv)
+{
+    const struct emul *target;
+    uint32_t count;
+    long err_code = EIO;
+    int err = 0;
+
+    if (parse_instance(sh, argv[1], &target))
+    {
+        return -EINVAL;
+    }
+
+    if (!strcmp(argv[2], "stuck"))
+    {
+        count = AS5600_EMUL_FAULT_STUCK;
+    }
+    else
+    {
+        count = shell_strtoul(argv[2], 10, &err);
+    }
+    if (!err && argc > 3)
+    {
+        err_code = shell_strtol(argv[3], 10, &err);
+    }
+    if (err || err_code <= 0)
+    {
+        shell_error(sh, "Expected <sensor> <count|stuck> [errno]");
+        return -EINVAL;
+    }
+
+    as5600_emul_inject_faults(target, count, -err_code);
+
+    return 0;
+}
+
+static int cmd_delay(const struct shell *sh, size_t argc, char **argv)
+{
+    const struct emul *target;
+    int err = 0;
+
+    ARG_UNUSED(argc);
+
+    if (parse_instance(sh, argv[1], &target))
+    {
+        return -EINVAL;
+    }
+
+    uint32_t count = shell_strtoul(argv[2], 10, &err);
+    uint32_t delay_us = err ? 0 : shell_strtoul(argv[3], 10, &err);
+
+    if (err)
+    {
+        shell_error(sh, "Expected <sensor> <count> <us>");
+        return -EINVAL;
+    }
+
+    as5600_emul_inject_delay(target, count, delay_us);
+
+    return 0;
+}
+
+static int cmd_faults(const struct shell *sh, size_t argc, char **argv)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(instances); i++)
+    {
+        if (instances[i])
+        {
+            shell_print(sh, "sensor %u: failed transfers %u", (unsigned int)i, as5600_emul_faults_served(instances[i]));
+        }
+    }
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    as5600_emul_cmds,
+    SHELL_CMD_ARG(fault, NULL, "Fail transfers: <sensor> <count|stuck> [errno], a count of 0 clears", cmd_fault, 3, 1),
+    SHELL_CMD_ARG(delay, NULL, "Delay transfers: <sensor> <count> <us>, a count of 0 clears", cmd_delay, 4, 0),
+    SHELL_CMD(faults, NULL, "Show the transfers failed so far", cmd_faults),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(as5600_emul, &as5600_emul_cmds, "AS5600 emulator fault injection", NULL);
+#endif
@@ -0,0 +1,86 @@
+#ifndef AS5600_EMUL_H
+#define AS5600_EMUL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/drivers/emul.h>
+
+/* Counts per revolution of the emulated sensor */
+#define AS5600_EMUL_COUNTS 4096
+
+/* Fault count failing every transfer until cleared, a stuck bus */
+#define AS5600_EMUL_FAULT_STUCK UINT32_MAX
+
+/* One segment of a scripted angle waveform */
+struct as5600_emul_segment
+{
+    /* Angular velocity in counts per second, negative values turn backwards */
+    int32_t velocity;
+    /* Time spent at this velocity */
+    uint32_t duration_ms;
+};
+
+/**
+ * @brief Play a scripted angle waveform, starting from the current angle.
+ *
+ * The segments are not copied and must outlive the waveform. After the last segment
+ * the angle holds still unless the waveform is repeated.
+ *
+ * @param target   AS5600 emulator
+ * @param segments Waveform segments
+ * @param count    Number of segments
+ * @param repeat   Restart from the first segment after the last one
+ */
+void as5600_emul_set_waveform(const struct emul *target, const struct as5600_emul_segment *segments,
+                              size_t count, bool repeat);
+
+/**
+ * @brief Stop any waveform and hold the sensor at a fixed angle.
+ *
+ * @param target AS5600 emulator
+ * @param angle  Angle in counts, wrapped to 0-4095
+ */
+void as5600_emul_set_angle(const struct emul *target, uint16_t angle);
+
+/**
+ * @brief Get the angle the emulator is currently serving.
+ *
+ * @param target AS5600 emulator
+ * @return Angle in counts
+ */
+uint16_t as5600_emul_get_angle(const struct emul *target);
+
+/**
+ * @brief Fail the next transfers with an error.
+ *
+ * Stands in for a NAK or a stuck bus. A failed transfer leaves the registers untouched.
+ *
+ * @param target AS5600 emulator
+ * @param count  Transfers to fail, AS5600_EMUL_FAULT_STUCK until cleared, 0 clears
+ * @param err    Negative errno the transfers fail with
+ */
+void as5600_emul_inject_faults(const struct emul *target, uint32_t count, int err);
+
+/**
+ * @brief Delay the next transfers.
+ *
+ * Stands in for a sensor stretching the clock. The transfers complete normally after the
+ * delay, the thread running them sleeps meanwhile.
+ *
+ * @param target   AS5600 emulator
+ * @param count    Transfers to delay, 0 clears
+ * @param delay_us Time each delayed transfer takes
+ */
+void as5600_emul_inject_delay(const struct emul *target, uint32_t count, uint32_t delay_us);
+
+/**
+ * @brief Get the transfers failed by injected faults so far.
+ *
+ * @param target AS5600 emulator
+ * @return Failed transfers
+ */
+uint32_t as5600_emul_faults_served(const struct emul *target);
+
+#endif /* AS5600_EMUL_H */
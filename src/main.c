@@ -8,22 +8,24 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_DBG);
 
 #include "scroller_config.h"
 
-struct scroller_config_t SCROLLER_CONFIG;
-struct k_mutex scroller_config_mutex;
-
 /* Initialize global config */
 void init_conf()
 {
-        /* Initialize config and config mutex */
-        SCROLLER_CONFIG = (struct scroller_config_t){
-            .scroll_accumulator = 0,
-            .internal_divider = SCROLLER_STEPS_LOW_RES,
-        };
+        k_spinlock_key_t key;
+        struct scroller_config_t *config = scroller_config_edit(&key);
+
+        /* Publish the defaults before any module reads the config */
+        *config = (struct scroller_config_t)SCROLLER_CONFIG_DEFAULTS;
+
+        scroller_config_commit(key);
 
-        k_mutex_init(&scroller_config_mutex);
+        /* Tuning saved from the shell replaces the defaults */
+        if (scroller_config_load())
+        {
+                LOG_WRN("Saved settings not loaded");
+        }
 }
 
-// FIXME: Control over usb serial device descriptor? To be able to change settings? Could be later used for test harnessing?
 // FIXME: Timer based wake to check the sensor and see if it has changed value. If so, wake the device
 int main(void)
 {
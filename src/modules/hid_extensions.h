@@ -35,6 +35,15 @@
  */
 #define HID_PHYSICAL_MAX16(a, b) HID_ITEM(HID_ITEM_TAG_PHYSICAL_MAX, HID_ITEM_TYPE_GLOBAL, 2), a, b
 
+/**
+ * @brief Define HID Usage Page item with the data length of two bytes.
+ *
+ * @param a Usage Page lower byte
+ * @param b Usage Page higher byte
+ * @return  HID Usage Page item
+ */
+#define HID_USAGE_PAGE16(a, b) HID_ITEM(HID_ITEM_TAG_USAGE_PAGE, HID_ITEM_TYPE_GLOBAL, 2), a, b
+
 #define HID_USAGE_16(a, b) HID_ITEM(HID_ITEM_TAG_USAGE, HID_ITEM_TYPE_LOCAL, 2), a, b
 
 #endif /* HID_EXTENSIONS_H */
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef SCROLLER_ACQUIRE_H
+#define SCROLLER_ACQUIRE_H
+
+#include <stdint.h>
+
+/* RTIO acquisition counters */
+struct acquire_stats
+{
+    /* Angles read, per sensor */
+    uint32_t samples;
+    /* Failed submissions and reads, retries included */
+    uint32_t i2c_errors;
+    /* Reads cancelled after not completing in time, or not started because the bus still ran the
+     * cancelled ones. Counted in the errors as well
+     */
+    uint32_t timeouts;
+    /* Reads repeated after a failure */
+    uint32_t retries;
+    /* Bus recoveries after the retries failed, and those that failed themselves */
+    uint32_t recoveries;
+    uint32_t recovery_errors;
+    /* Reads given up after the retries, the last good angle was kept */
+    uint32_t dropped;
+    /* Stalls too long to bridge, the reference was set again */
+    uint32_t resyncs;
+    /* Longest time an axis went without a good angle because of failed reads */
+    uint32_t max_stall_us;
+    /* Timer ticks lost because the previous read was still running */
+    uint32_t overruns;
+};
+
+/**
+ * @brief Read the acquisition counters.
+ *
+ * @param stats Output for the counters
+ */
+void acquire_stats_get(struct acquire_stats *stats);
+
+/**
+ * @brief Notify acquisition of a USB start of frame.
+ *
+ * Called from the USB stack every frame. Schedules a sample to complete just before
+ * the host polls the interrupt endpoint.
+ */
+void acquire_sof(void);
+
+/**
+ * @brief Notify acquisition that the host collected an IN report.
+ *
+ * Called from the USB stack on IN completion. Locks the sample schedule to the frame
+ * the host polls in.
+ */
+void acquire_in_complete(void);
+
+#endif /* SCROLLER_ACQUIRE_H */
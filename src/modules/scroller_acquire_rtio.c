@@ -0,0 +1,758 @@
+#define MODULE scroller_acquire
+#include <caf/events/module_state_event.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/rtio/rtio.h>
+#include <stdlib.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_DBG);
+
+#include "scroller_acquire.h"
+#include "scroller_config.h"
+#include "scroller_scroll_calculate.h"
+#include "scroller_scroll_engine.h"
+#include "scroller_sample_scheduler.h"
+#include "scroller_latency.h"
+#include "scroller_profile.h"
+#include <caf/events/power_event.h>
+
+/* Angle register, high byte holds bits 11:8, low byte holds bits 7:0 */
+#define AS5600_REG_ANGLE_H 0x0E
+#define AS5600_ANGLE_MASK 0x0FFF
+
+#define STEP_SENSOR DT_NODELABEL(as5600)
+
+/* I2C RTIO devices for the sensors and the RTIO context for the burst reads. Each read is
+ * a register write and a 2 byte read. A read cancelled after a timeout stays with the bus
+ * until the driver completes it, so the pool holds it and the retry for every sensor.
+ */
+I2C_DT_IODEV_DEFINE(as5600_iodev, STEP_SENSOR);
+#if SCROLLER_HAS_PAN
+I2C_DT_IODEV_DEFINE(as5600_pan_iodev, SCROLLER_PAN_NODE);
+#define AXIS_COUNT 2
+#else
+#define AXIS_COUNT 1
+#endif
+#define READS_PER_AXIS 2
+RTIO_DEFINE(as5600_rtio, 2 * READS_PER_AXIS * AXIS_COUNT, READS_PER_AXIS * AXIS_COUNT);
+
+/* Sensor per axis */
+static struct
+{
+    /* Sensor bus, used to check the bus is ready before sampling */
+    const struct i2c_dt_spec i2c;
+    struct rtio_iodev *iodev;
+    /* DMA target for the angle registers */
+    uint8_t angle_buf[2];
+} sensors[AXIS_COUNT] = {
+    [SCROLL_AXIS_WHEEL] = {.i2c = I2C_DT_SPEC_GET(STEP_SENSOR), .iodev = &as5600_iodev},
+#if SCROLLER_HAS_PAN
+    [SCROLL_AXIS_PAN] = {.i2c = I2C_DT_SPEC_GET(SCROLLER_PAN_NODE), .iodev = &as5600_pan_iodev},
+#endif
+};
+
+/* Register address written before every read */
+static const uint8_t angle_reg = AS5600_REG_ANGLE_H;
+
+/* First SQE of the transaction of each submitted read, to cancel it on a timeout */
+static struct rtio_sqe *read_sqes[AXIS_COUNT];
+/* Submission count, carried in the completion with the axis. A completion of a read that
+ * timed out arrives late and is told apart by it.
+ */
+static uint8_t read_sequence;
+/* Reads submitted per axis whose completion hasn't been collected, timed out ones included */
+static uint8_t reads_in_flight[AXIS_COUNT];
+
+/* Timer starting a read, and the semaphore handing it to the acquisition thread */
+static struct k_timer sample_timer;
+static K_SEM_DEFINE(sample_sem, 0, 1);
+
+static K_THREAD_STACK_DEFINE(acquire_thread_stack, CONFIG_SCROLLER_ACQUIRE_STACK_SIZE);
+static struct k_thread acquire_thread;
+
+/* Sample and bus error counters */
+static struct acquire_stats stats;
+
+/* Read schedule, every read falls due at its exact share of the sampling period counted from
+ * the start. The tick rounding spreads over the reads instead of stretching each: at 32768 Hz
+ * the four reads of a 1 ms period take 8, 8, 8 and 9 ticks rather than 9 ticks each.
+ */
+static struct
+{
+    int64_t start_ticks;
+    uint64_t reads;
+    uint32_t period_us;
+    struct k_spinlock lock;
+} schedule;
+
+/* Arm the timer for the next read due */
+static void schedule_read(void)
+{
+    uint64_t offset_us = schedule.reads * schedule.period_us / CONFIG_SCROLLER_OVERSAMPLE;
+
+    k_timer_start(&sample_timer, K_TIMEOUT_ABS_TICKS(schedule.start_ticks + k_us_to_ticks_ceil64(offset_us)),
+                  K_NO_WAIT);
+}
+
+/* Restart the schedule from now, the first read due after the given number of reads */
+static void schedule_start(uint32_t period_ms, uint32_t first_read)
+{
+    k_spinlock_key_t key = k_spin_lock(&schedule.lock);
+
+    schedule.start_ticks = k_uptime_ticks();
+    schedule.reads = first_read;
+    schedule.period_us = period_ms * USEC_PER_MSEC;
+    schedule_read();
+
+    k_spin_unlock(&schedule.lock, key);
+}
+
+static void sample_timer_cb(struct k_timer *timer_id)
+{
+    ARG_UNUSED(timer_id);
+
+    /* The previous tick hasn't been picked up, this one is lost */
+    if (k_sem_count_get(&sample_sem))
+    {
+        stats.overruns++;
+    }
+    k_sem_give(&sample_sem);
+
+    /* Start of frame sync arms a single read per poll instead */
+    if (!IS_ENABLED(CONFIG_SCROLLER_SAMPLE_SOF_SYNC))
+    {
+        k_spinlock_key_t key = k_spin_lock(&schedule.lock);
+
+        schedule.reads++;
+        schedule_read();
+
+        k_spin_unlock(&schedule.lock, key);
+    }
+}
+
+/* Oversampled reads of the current sample per axis, as wrap corrected offsets from the
+ * first read so that averaging across the zero point works.
+ */
+static struct
+{
+    int32_t first;
+    int32_t offset_sum;
+    uint32_t reads;
+} decimator[AXIS_COUNT];
+/* Timer ticks into the current sample */
+static uint32_t decimate_phase;
+/* Set when sampling restarts, the reads and stalls from before are stale */
+static atomic_t sampling_restart = ATOMIC_INIT(0);
+
+/* Read failures per axis. The engine keeps the last good angle as its reference, so the
+ * next good one carries the whole change over the time since.
+ */
+static struct
+{
+    /* Time of the last good angle */
+    uint32_t good_cycles;
+    /* Reads failed since */
+    bool stalled;
+} health[AXIS_COUNT];
+
+static void decimate_add(enum scroll_axis axis, int32_t angle)
+{
+    int32_t offset = angle - decimator[axis].first;
+
+    if (!decimator[axis].reads++)
+    {
+        decimator[axis].first = angle;
+        decimator[axis].offset_sum = 0;
+        return;
+    }
+
+    if (offset > SCROLL_ENGINE_COUNTS / 2)
+    {
+        offset -= SCROLL_ENGINE_COUNTS;
+    }
+    else if (offset < -SCROLL_ENGINE_COUNTS / 2)
+    {
+        offset += SCROLL_ENGINE_COUNTS;
+    }
+    decimator[axis].offset_sum += offset;
+}
+
+/* Average the reads of a sample, rounded in Q8. False if every read of the axis failed */
+static bool decimate_take(enum scroll_axis axis, int32_t *angle)
+{
+    uint32_t reads = decimator[axis].reads;
+
+    if (!reads)
+    {
+        return false;
+    }
+
+    int32_t mean_q8 = decimator[axis].offset_sum * 256 / (int32_t)reads;
+
+    *angle = (decimator[axis].first + ((mean_q8 + 128) >> 8)) & AS5600_ANGLE_MASK;
+    decimator[axis].reads = 0;
+
+    return true;
+}
+
+/* Axes whose bus still holds as many timed out reads as the pool has room for */
+static uint32_t busy_axes(void)
+{
+    uint32_t busy = 0;
+
+    for (int axis = 0; axis < AXIS_COUNT; axis++)
+    {
+        if (reads_in_flight[axis] >= READS_PER_AXIS)
+        {
+            busy |= BIT(axis);
+        }
+    }
+
+    return busy;
+}
+
+/* Queue the angle register burst read of the sensors, each as a single I2C transaction */
+static int submit_angle_read(uint32_t axes)
+{
+    read_sequence++;
+
+    for (int axis = 0; axis < AXIS_COUNT; axis++)
+    {
+        if (!(axes & BIT(axis)))
+        {
+            continue;
+        }
+
+        struct rtio_sqe *write_sqe = rtio_sqe_acquire(&as5600_rtio);
+        struct rtio_sqe *read_sqe = rtio_sqe_acquire(&as5600_rtio);
+
+        if (write_sqe == NULL || read_sqe == NULL)
+        {
+            rtio_sqe_drop_all(&as5600_rtio);
+            return -ENOMEM;
+        }
+
+        rtio_sqe_prep_tiny_write(write_sqe, sensors[axis].iodev, RTIO_PRIO_HIGH, &angle_reg, sizeof(angle_reg),
+                                 NULL);
+        /* Only the read reports a completion */
+        write_sqe->flags |= RTIO_SQE_TRANSACTION | RTIO_SQE_NO_RESPONSE;
+
+        /* The axis and the sequence come back in the completion */
+        rtio_sqe_prep_read(read_sqe, sensors[axis].iodev, RTIO_PRIO_HIGH, sensors[axis].angle_buf,
+                           sizeof(sensors[axis].angle_buf), (void *)(uintptr_t)((read_sequence << 8) | axis));
+        read_sqe->iodev_flags |= RTIO_IODEV_I2C_RESTART | RTIO_IODEV_I2C_STOP;
+        read_sqes[axis] = write_sqe;
+    }
+
+    for (int axis = 0; axis < AXIS_COUNT; axis++)
+    {
+        if (axes & BIT(axis))
+        {
+            reads_in_flight[axis]++;
+        }
+    }
+
+    return rtio_submit(&as5600_rtio, 0);
+}
+
+/* Take the next completion of any read, sleeping until one arrives or the deadline passes */
+static bool take_completion(uintptr_t *userdata, int *result, k_timepoint_t deadline)
+{
+    /* One CQE per transaction. rtio_cqe_consume takes the count again, without waiting */
+    if (k_sem_take(as5600_rtio.consume_sem, sys_timepoint_timeout(deadline)))
+    {
+        return false;
+    }
+    k_sem_give(as5600_rtio.consume_sem);
+
+    struct rtio_cqe *cqe = rtio_cqe_consume(&as5600_rtio);
+
+    *userdata = (uintptr_t)cqe->userdata;
+    *result = MIN(cqe->result, 0);
+    rtio_cqe_release(&as5600_rtio, cqe);
+
+    /* The transaction and its SQEs are back in the pool */
+    reads_in_flight[*userdata & 0xFF]--;
+
+    return true;
+}
+
+/* Collect the completion of a submitted read, in whichever order the buses finish.
+ * False once the deadline passes without one.
+ */
+static bool complete_angle_read(enum scroll_axis *axis, int *result, k_timepoint_t deadline)
+{
+    uintptr_t userdata;
+
+    while (take_completion(&userdata, result, deadline))
+    {
+        /* Late completion of a read that timed out, its data is stale */
+        if ((uint8_t)(userdata >> 8) != read_sequence)
+        {
+            continue;
+        }
+
+        *axis = (enum scroll_axis)(userdata & 0xFF);
+
+        return true;
+    }
+
+    return false;
+}
+
+/* Collect the late completions of timed out reads on the axes, up to the deadline. Returns
+ * the axes whose bus still holds one
+ */
+static uint32_t drain_angle_reads(uint32_t axes, k_timepoint_t deadline)
+{
+    while (1)
+    {
+        uint32_t held = 0;
+        uintptr_t userdata;
+        int result;
+
+        for (int axis = 0; axis < AXIS_COUNT; axis++)
+        {
+            if ((axes & BIT(axis)) && reads_in_flight[axis])
+            {
+                held |= BIT(axis);
+            }
+        }
+
+        if (!held || !take_completion(&userdata, &result, deadline))
+        {
+            return held;
+        }
+    }
+}
+
+/* Give up on the reads still outstanding, they fail like any other read */
+static void cancel_angle_read(uint32_t axes)
+{
+    for (int axis = 0; axis < AXIS_COUNT; axis++)
+    {
+        if (axes & BIT(axis))
+        {
+            rtio_sqe_cancel(read_sqes[axis]);
+        }
+    }
+}
+
+/* Current sampling period */
+static uint32_t sample_period_ms = CONFIG_SCROLLER_ACQUIRE_PERIOD_MS;
+/* Sampling period last read from the tuning */
+static uint32_t tuned_period_ms = SCROLLER_SAMPLE_PERIOD_DEFAULT_MS;
+
+void acquire_stats_get(struct acquire_stats *out)
+{
+    *out = stats;
+}
+
+static uint32_t tuned_sample_period(void)
+{
+    struct scroller_config_t config;
+
+    scroller_config_get(&config);
+
+    return MAX(config.tuning.sample_period_ms, 1);
+}
+
+/* Reprogram the sample timer if the scheduler changed the period */
+static void set_sample_period(uint32_t period_ms)
+{
+    if (period_ms == sample_period_ms)
+    {
+        return;
+    }
+
+    sample_period_ms = period_ms;
+
+    /* Start of frame sync uses the period to decimate polls instead */
+    if (!IS_ENABLED(CONFIG_SCROLLER_SAMPLE_SOF_SYNC))
+    {
+        schedule_start(period_ms, 1);
+    }
+}
+
+#ifdef CONFIG_SCROLLER_SAMPLE_SOF_SYNC
+/* Frames counted from start of frame, one per ms on full speed USB */
+static atomic_t sof_frame = ATOMIC_INIT(0);
+/* Frame phase, modulo the poll interval, the host polls the IN endpoint in */
+static atomic_t poll_phase = ATOMIC_INIT(0);
+/* Frame the last synchronized sample was scheduled for */
+static uint32_t last_sample_frame;
+/* Sampling only runs while the device is awake */
+static bool sof_sampling;
+
+void acquire_sof(void)
+{
+    uint32_t next_frame = (uint32_t)atomic_inc(&sof_frame) + 2;
+
+    if (!sof_sampling)
+    {
+        return;
+    }
+
+    /* Only sample in the frame before the host polls */
+    if ((next_frame - (uint32_t)atomic_get(&poll_phase)) % SCROLLER_POLL_INTERVAL_MS != 0)
+    {
+        return;
+    }
+
+    /* Skip polls while the scheduler has backed off */
+    if (next_frame - last_sample_frame < sample_period_ms)
+    {
+        return;
+    }
+    last_sample_frame = next_frame;
+
+    /* Complete the read the lead time before the next frame starts */
+    k_timer_start(&sample_timer, K_USEC(USEC_PER_MSEC - CONFIG_SCROLLER_SAMPLE_SOF_LEAD_US), K_NO_WAIT);
+}
+
+void acquire_in_complete(void)
+{
+    /* The host polled in the current frame */
+    atomic_set(&poll_phase, atomic_get(&sof_frame) % SCROLLER_POLL_INTERVAL_MS);
+}
+#endif
+
+/* Hand a position to the scroll calculation, tracking the largest change */
+static void process_angle(enum scroll_axis axis, int32_t angle, int16_t *max_delta)
+{
+    int16_t delta = scroll_process_position(axis, angle);
+
+    if (abs(delta) > abs(*max_delta))
+    {
+        *max_delta = delta;
+    }
+}
+
+/* A good angle ends a stall of the axis. A stall too long for the wrap handling to
+ * resolve the change sets a new reference instead of reading as a jump.
+ */
+static void angle_good(enum scroll_axis axis)
+{
+    uint32_t now = k_cycle_get_32();
+
+    if (health[axis].stalled)
+    {
+        uint32_t stall_us = k_cyc_to_us_floor32(now - health[axis].good_cycles);
+
+        health[axis].stalled = false;
+        stats.max_stall_us = MAX(stats.max_stall_us, stall_us);
+        if (stall_us > CONFIG_SCROLLER_ACQUIRE_RESYNC_MS * USEC_PER_MSEC)
+        {
+            stats.resyncs++;
+            scroll_resync(axis);
+        }
+        LOG_INF("Axis %d reads again after %u us", axis, stall_us);
+    }
+    health[axis].good_cycles = now;
+}
+
+/* Drop the sample of every axis still failing after the retries and recover its bus,
+ * once per bus. A bus still running a timed out read is left to its driver. The next
+ * tick reads again.
+ */
+static void recover(uint32_t failed)
+{
+    const struct device *recovered[AXIS_COUNT];
+    int recovered_count = 0;
+    uint32_t held = drain_angle_reads(failed, sys_timepoint_calc(K_USEC(CONFIG_SCROLLER_ACQUIRE_READ_TIMEOUT_US)));
+
+    for (int axis = 0; axis < AXIS_COUNT; axis++)
+    {
+        if (!(failed & BIT(axis)))
+        {
+            continue;
+        }
+
+        stats.dropped++;
+        if (!health[axis].stalled)
+        {
+            health[axis].stalled = true;
+            LOG_WRN("Axis %d reads failing, keeping the last good angle", axis);
+        }
+
+        const struct device *bus = sensors[axis].i2c.bus;
+        bool done = false;
+
+        for (int i = 0; i < recovered_count; i++)
+        {
+            done |= recovered[i] == bus;
+        }
+        if (done)
+        {
+            continue;
+        }
+        recovered[recovered_count++] = bus;
+
+        if (held & BIT(axis))
+        {
+            LOG_DBG("Bus of axis %d still runs a timed out read, not recovered", axis);
+            continue;
+        }
+
+        stats.recoveries++;
+        int err = i2c_recover_bus(bus);
+
+        if (err)
+        {
+            stats.recovery_errors++;
+            LOG_DBG("Bus recovery of axis %d failed: %d", axis, err);
+        }
+    }
+}
+
+/* Read every sensor, repeating the reads that failed. Returns the axes still failing */
+static uint32_t read_angles(int16_t *max_delta)
+{
+    uint32_t pending = BIT_MASK(AXIS_COUNT);
+
+    for (int attempt = 0; pending && attempt <= CONFIG_SCROLLER_I2C_RETRIES; attempt++)
+    {
+        /* An axis whose bus still holds its timed out reads can't take another, it times out again */
+        uint32_t busy = pending & busy_axes();
+        uint32_t submitted = pending & ~busy;
+        int err;
+
+        if (attempt)
+        {
+            stats.retries++;
+        }
+
+        if (busy)
+        {
+            stats.i2c_errors++;
+            stats.timeouts++;
+            LOG_DBG("Reads still on the bus, axes 0x%x", busy);
+        }
+        if (!submitted)
+        {
+            continue;
+        }
+
+        err = submit_angle_read(submitted);
+        if (err)
+        {
+            stats.i2c_errors++;
+            LOG_DBG("Submit error: %d", err);
+            continue;
+        }
+
+        k_timepoint_t deadline = sys_timepoint_calc(K_USEC(CONFIG_SCROLLER_ACQUIRE_READ_TIMEOUT_US));
+        /* Submitted axes without a completion yet */
+        uint32_t outstanding = submitted;
+
+        /* One completion per submitted axis, in whichever order the buses finish */
+        for (int i = 0; i < AXIS_COUNT; i++)
+        {
+            enum scroll_axis axis;
+
+            if (!(submitted & BIT(i)))
+            {
+                continue;
+            }
+
+            if (!complete_angle_read(&axis, &err, deadline))
+            {
+                /* A hung bus, the outstanding axes stay pending for the retries and the recovery */
+                cancel_angle_read(outstanding);
+                profile_reads(POPCOUNT(outstanding));
+                stats.i2c_errors++;
+                stats.timeouts++;
+                LOG_DBG("Read timeout, axes 0x%x", outstanding);
+                break;
+            }
+            outstanding &= ~BIT(axis);
+            profile_reads(1);
+            if (err)
+            {
+                stats.i2c_errors++;
+                LOG_DBG("Read error on axis %d: %d", axis, err);
+                continue;
+            }
+            stats.samples++;
+            pending &= ~BIT(axis);
+            angle_good(axis);
+
+            const uint8_t *buf = sensors[axis].angle_buf;
+            int32_t angle = ((buf[0] << 8) | buf[1]) & AS5600_ANGLE_MASK;
+
+            if (CONFIG_SCROLLER_OVERSAMPLE > 1)
+            {
+                decimate_add(axis, angle);
+            }
+            else
+            {
+                process_angle(axis, angle, max_delta);
+            }
+        }
+    }
+
+    return pending;
+}
+
+/* Acquisition thread, one burst read per timer tick and one position per sample */
+static void acquire_thread_fn(void)
+{
+    while (1)
+    {
+        k_sem_take(&sample_sem, K_FOREVER);
+
+        if (atomic_clear(&sampling_restart))
+        {
+            decimate_phase = 0;
+            for (int axis = 0; axis < AXIS_COUNT; axis++)
+            {
+                decimator[axis].reads = 0;
+                health[axis].good_cycles = k_cycle_get_32();
+                health[axis].stalled = false;
+            }
+        }
+
+        latency_mark(LATENCY_STAGE_FETCH);
+
+        /* Largest change of any axis drives the sample schedule */
+        int16_t max_delta = 0;
+        uint32_t failed = read_angles(&max_delta);
+
+        if (failed)
+        {
+            recover(failed);
+        }
+
+        /* Oversampling, the sample is complete once every read of it is in */
+        if (CONFIG_SCROLLER_OVERSAMPLE > 1)
+        {
+            if (++decimate_phase < CONFIG_SCROLLER_OVERSAMPLE)
+            {
+                continue;
+            }
+            decimate_phase = 0;
+
+            for (int axis = 0; axis < AXIS_COUNT; axis++)
+            {
+                int32_t angle;
+
+                if (decimate_take(axis, &angle))
+                {
+                    process_angle(axis, angle, &max_delta);
+                }
+            }
+        }
+
+        /* Pick up a period tuned from the shell */
+        uint32_t tuned = tuned_sample_period();
+
+        if (tuned != tuned_period_ms)
+        {
+            tuned_period_ms = tuned;
+            set_sample_period(IS_ENABLED(CONFIG_SCROLLER_SAMPLE_ADAPTIVE) ? sample_scheduler_reset(tuned) : tuned);
+        }
+        else if (IS_ENABLED(CONFIG_SCROLLER_SAMPLE_ADAPTIVE) && failed != BIT_MASK(AXIS_COUNT))
+        {
+            /* A tick without any angle says nothing about motion */
+            set_sample_period(sample_scheduler_update(max_delta));
+        }
+    }
+}
+
+static int init()
+{
+    for (int axis = 0; axis < AXIS_COUNT; axis++)
+    {
+        if (!i2c_is_ready_dt(&sensors[axis].i2c))
+        {
+            LOG_ERR("I2C bus of axis %d not ready", axis);
+            return -ENODEV;
+        }
+    }
+
+    k_timer_init(&sample_timer, sample_timer_cb, NULL);
+
+    k_thread_create(&acquire_thread, acquire_thread_stack, K_THREAD_STACK_SIZEOF(acquire_thread_stack),
+                    (k_thread_entry_t)acquire_thread_fn, NULL, NULL, NULL,
+                    CONFIG_SCROLLER_ACQUIRE_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&acquire_thread, "acquire");
+
+    return 0;
+}
+
+static void start_sampling(void)
+{
+    tuned_period_ms = tuned_sample_period();
+    sample_period_ms = tuned_period_ms;
+    atomic_set(&sampling_restart, 1);
+
+    /* Waking up means the wheel is likely moving, start at the fast period */
+    if (IS_ENABLED(CONFIG_SCROLLER_SAMPLE_ADAPTIVE))
+    {
+        sample_period_ms = sample_scheduler_reset(tuned_period_ms);
+    }
+
+#ifdef CONFIG_SCROLLER_SAMPLE_SOF_SYNC
+    /* Samples are started from start of frame */
+    sof_sampling = true;
+#else
+    schedule_start(sample_period_ms, 0);
+#endif
+}
+
+static void stop_sampling(void)
+{
+#ifdef CONFIG_SCROLLER_SAMPLE_SOF_SYNC
+    sof_sampling = false;
+#endif
+    k_timer_stop(&sample_timer);
+    k_sem_reset(&sample_sem);
+}
+
+static void process_module_state_event(struct module_state_event *event)
+{
+    int err;
+
+    if (check_state(event, MODULE_ID(main), MODULE_STATE_READY))
+    {
+        err = init();
+        if (err)
+        {
+            module_set_state(MODULE_STATE_ERROR);
+            LOG_ERR("Init err: %d", err);
+        }
+        else
+        {
+            module_set_state(MODULE_STATE_READY);
+            start_sampling();
+        }
+    }
+}
+
+static bool app_event_handler(const struct app_event_header *aeh)
+{
+    if (is_module_state_event(aeh))
+    {
+        struct module_state_event *event = cast_module_state_event(aeh);
+        process_module_state_event(event);
+    }
+    else if (is_power_down_event(aeh))
+    {
+        stop_sampling();
+    }
+    else if (is_wake_up_event(aeh))
+    {
+        start_sampling();
+    }
+
+    /* Don't consume the event */
+    return false;
+}
+APP_EVENT_LISTENER(MODULE, app_event_handler);
+APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
+APP_EVENT_SUBSCRIBE(MODULE, power_down_event);
+APP_EVENT_SUBSCRIBE(MODULE, wake_up_event);
@@ -0,0 +1,536 @@
+#define MODULE scroller_ble
+#include <caf/events/module_state_event.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_DBG);
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/settings/settings.h>
+#include <bluetooth/services/hids.h>
+
+#include "usb_state_event.h"
+#include "scroller_ble.h"
+#include "scroller_config.h"
+#include "scroller_step_accumulator.h"
+#include "scroller_latency.h"
+#include "scroller_profile.h"
+#include <caf/events/force_power_down_event.h>
+#include <caf/events/power_event.h>
+
+/* HID report descriptor, shared with USB */
+static const uint8_t hid_report_desc[] = HID_WHEEL_REPORT_DESC();
+
+/* Wheel input report without the report id, HOGP carries the id in the report reference */
+struct __packed ble_wheel_report_t
+{
+    int16_t wheel;
+    int16_t pan;
+};
+
+#define INPUT_REP_WHEEL_IDX 0
+#define FEATURE_REP_RES_MULT_IDX 0
+#define FEATURE_REP_LATENCY_IDX 1
+
+/* Every input and feature report size, the connection context holds each */
+#ifdef CONFIG_SCROLLER_LATENCY_STATS
+BT_HIDS_DEF(hids_obj, sizeof(struct ble_wheel_report_t), SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE,
+            SCROLLER_LATENCY_REPORT_SIZE);
+
+/* Latency report with its id, filled on read */
+static struct latency_report_t latency_report;
+#else
+BT_HIDS_DEF(hids_obj, sizeof(struct ble_wheel_report_t), SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE);
+#endif
+
+static const struct bt_data ad[] = {
+    BT_DATA_BYTES(BT_DATA_GAP_APPEARANCE,
+                  (CONFIG_BT_DEVICE_APPEARANCE >> 0) & 0xff,
+                  (CONFIG_BT_DEVICE_APPEARANCE >> 8) & 0xff),
+    BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+    BT_DATA_BYTES(BT_DATA_UUID16_ALL, BT_UUID_16_ENCODE(BT_UUID_HIDS_VAL)),
+};
+
+static const struct bt_data sd[] = {
+    BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+/* Connection parameters while the wheel moves and while it is idle */
+static const struct bt_le_conn_param active_param = BT_LE_CONN_PARAM_INIT(
+    CONFIG_SCROLLER_BLE_ACTIVE_INTERVAL, CONFIG_SCROLLER_BLE_ACTIVE_INTERVAL, 0, 400);
+static const struct bt_le_conn_param idle_param = BT_LE_CONN_PARAM_INIT(
+    CONFIG_SCROLLER_BLE_IDLE_INTERVAL, CONFIG_SCROLLER_BLE_IDLE_INTERVAL, CONFIG_SCROLLER_BLE_IDLE_LATENCY, 400);
+
+/* Connected central, only one at a time */
+static struct bt_conn *active_conn;
+/* USB takes over sending while configured */
+static bool usb_configured;
+/* Sender running */
+static bool sending;
+/* Connection parameters currently requested */
+static bool active_interval;
+
+/* Drops back to the idle connection interval once the wheel stops */
+static struct k_work_delayable idle_work;
+/* Restarts advertising once the connection is released, the stack doesn't resume it */
+static struct k_work adv_work;
+
+/* Notification slot, one notification in flight so each connection event
+ * carries every step coalesced since the previous one.
+ */
+static K_SEM_DEFINE(notify_slot_sem, 1, 1);
+
+static K_THREAD_STACK_DEFINE(ble_thread_stack, CONFIG_SCROLLER_BLE_STACK_SIZE);
+static struct k_thread ble_thread;
+
+/* Notification statistics of the current connection */
+static struct
+{
+    uint32_t reports;
+    uint32_t submit_cycles;
+    uint32_t last_cycles;
+    /* Connection interval in use, and the connection events the notifications spread over */
+    uint32_t interval_us;
+    uint32_t events;
+    uint32_t latency_min_us;
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;
+} notify_stats = {.latency_min_us = UINT32_MAX};
+
+void ble_notify_stats_get(struct ble_notify_stats *stats)
+{
+    uint32_t reports = notify_stats.reports;
+
+    stats->reports = reports;
+    stats->events = notify_stats.events;
+    stats->latency_min_us = reports ? notify_stats.latency_min_us : 0;
+    stats->latency_avg_us = reports ? (uint32_t)(notify_stats.latency_total_us / reports) : 0;
+    stats->latency_max_us = notify_stats.latency_max_us;
+}
+
+static void log_notify_stats(void)
+{
+    struct ble_notify_stats stats;
+
+    ble_notify_stats_get(&stats);
+    if (!stats.reports)
+    {
+        return;
+    }
+
+    LOG_INF("Notifications: %u, per 100 connection events: %u, latency (us) min: %u, avg: %u, max: %u",
+            stats.reports, stats.reports * 100 / stats.events, stats.latency_min_us, stats.latency_avg_us,
+            stats.latency_max_us);
+}
+
+/* Notification sent in a connection event */
+static void notify_done_cb(struct bt_conn *conn, void *user_data)
+{
+    ARG_UNUSED(conn);
+    ARG_UNUSED(user_data);
+
+    uint32_t now = k_cycle_get_32();
+    uint32_t latency_us = k_cyc_to_us_floor32(now - notify_stats.submit_cycles);
+
+    /* Connection events since the previous notification, rounded against the clock granularity */
+    if (notify_stats.reports == 0)
+    {
+        notify_stats.events = 1;
+    }
+    else
+    {
+        uint32_t elapsed_us = k_cyc_to_us_floor32(now - notify_stats.last_cycles);
+
+        notify_stats.events += (elapsed_us + notify_stats.interval_us / 2) / notify_stats.interval_us;
+    }
+    notify_stats.last_cycles = now;
+    notify_stats.reports++;
+    notify_stats.latency_min_us = MIN(notify_stats.latency_min_us, latency_us);
+    notify_stats.latency_max_us = MAX(notify_stats.latency_max_us, latency_us);
+    notify_stats.latency_total_us += latency_us;
+
+    latency_mark(LATENCY_STAGE_IN_COMPLETE);
+    k_sem_give(&notify_slot_sem);
+}
+
+static void request_conn_param(bool active)
+{
+    int err;
+
+    if (active_conn == NULL || active_interval == active)
+    {
+        return;
+    }
+
+    err = bt_conn_le_param_update(active_conn, active ? &active_param : &idle_param);
+    if (err)
+    {
+        LOG_WRN("Connection parameter update failed: %d", err);
+        return;
+    }
+
+    active_interval = active;
+}
+
+static void idle_work_fn(struct k_work *work)
+{
+    ARG_UNUSED(work);
+    request_conn_param(false);
+}
+
+/* BLE HID report sending thread */
+static void ble_thread_fn(void)
+{
+    struct ble_wheel_report_t report = {0};
+    int err;
+
+    while (1)
+    {
+        int16_t steps[SCROLL_AXIS_COUNT];
+
+        /* Wait until the previous notification went out in a connection event */
+        k_sem_take(&notify_slot_sem, K_FOREVER);
+
+        err = step_accumulator_get(steps, NULL, K_FOREVER);
+        if (err)
+        {
+            k_sem_give(&notify_slot_sem);
+            continue;
+        }
+        latency_mark(LATENCY_STAGE_DEQUEUE);
+        uint64_t profile_start = profile_begin();
+
+        /* Shorten the connection interval while moving, relax it once idle */
+        request_conn_param(true);
+        k_work_reschedule(&idle_work, K_MSEC(CONFIG_SCROLLER_BLE_IDLE_TIMEOUT_MS));
+
+        report.wheel = sys_cpu_to_le16(steps[SCROLL_AXIS_WHEEL]);
+        report.pan = sys_cpu_to_le16(steps[SCROLL_AXIS_PAN]);
+
+        latency_mark(LATENCY_STAGE_EP_WRITE);
+        notify_stats.submit_cycles = k_cycle_get_32();
+        err = bt_hids_inp_rep_send(&hids_obj, active_conn, INPUT_REP_WHEEL_IDX,
+                                   (uint8_t *)&report, sizeof(report), notify_done_cb);
+        profile_end(PROFILE_SECTION_SEND, profile_start);
+        if (err)
+        {
+            /* Keep the steps for the next connection event */
+            for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+            {
+                step_accumulator_put(axis, steps[axis]);
+            }
+            LOG_DBG("Report not sent, retrying: %d", err);
+            k_sem_give(&notify_slot_sem);
+            k_sleep(K_USEC(BT_CONN_INTERVAL_TO_US(CONFIG_SCROLLER_BLE_ACTIVE_INTERVAL)));
+        }
+        else
+        {
+            profile_report();
+        }
+    }
+}
+
+/* Run the sender while a central is connected and USB isn't sending */
+static void update_sender(void)
+{
+    bool run = active_conn != NULL && !usb_configured;
+
+    if (run == sending)
+    {
+        return;
+    }
+
+    sending = run;
+
+    if (run)
+    {
+        /* Start sender then sensor to keep send buffer clear */
+        k_sem_reset(&notify_slot_sem);
+        k_sem_give(&notify_slot_sem);
+        k_thread_resume(&ble_thread);
+
+        struct wake_up_event *event = new_wake_up_event();
+        APP_EVENT_SUBMIT(event);
+    }
+    else
+    {
+        log_notify_stats();
+
+        k_thread_suspend(&ble_thread);
+        k_work_cancel_delayable(&idle_work);
+
+        if (!usb_configured)
+        {
+            struct force_power_down_event *event = new_force_power_down_event();
+            APP_EVENT_SUBMIT(event);
+        }
+    }
+}
+
+/* Resolution Multiplier feature report, written by the host to enable high resolution scrolling */
+static void res_mult_handler(struct bt_hids_rep *rep, struct bt_conn *conn, bool write)
+{
+    ARG_UNUSED(conn);
+
+    if (write)
+    {
+        if (!scroller_config_set_res_mult(rep->data, rep->size))
+        {
+            LOG_INF("HI-res %s", scroller_config_is_hi_res() ? "enabled" : "disabled");
+        }
+    }
+    else
+    {
+        scroller_config_get_res_mult(rep->data);
+    }
+}
+
+#ifdef CONFIG_SCROLLER_LATENCY_STATS
+/* Latency statistics feature report, filled on read */
+static void latency_handler(struct bt_hids_rep *rep, struct bt_conn *conn, bool write)
+{
+    ARG_UNUSED(conn);
+
+    if (!write)
+    {
+        latency_report_fill(&latency_report);
+        /* HOGP reports exclude the report id */
+        memcpy(rep->data, (uint8_t *)&latency_report + 1, rep->size);
+    }
+}
+#endif
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+    if (err)
+    {
+        LOG_WRN("Connection failed: %u", err);
+        return;
+    }
+
+    if (active_conn)
+    {
+        LOG_WRN("Already connected");
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        return;
+    }
+
+    err = bt_hids_connected(&hids_obj, conn);
+    if (err)
+    {
+        LOG_ERR("HIDS connect failed: %d", err);
+        return;
+    }
+
+    struct bt_conn_info info;
+
+    active_conn = bt_conn_ref(conn);
+    active_interval = false;
+    memset(&notify_stats, 0, sizeof(notify_stats));
+    notify_stats.latency_min_us = UINT32_MAX;
+    /* The interval the central connected with, until it takes ours */
+    if (bt_conn_get_info(conn, &info))
+    {
+        info.le.interval = CONFIG_SCROLLER_BLE_IDLE_INTERVAL;
+    }
+    notify_stats.interval_us = BT_CONN_INTERVAL_TO_US(info.le.interval);
+
+    LOG_INF("Connected");
+    update_sender();
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    if (conn != active_conn)
+    {
+        return;
+    }
+
+    LOG_INF("Disconnected: 0x%02x", reason);
+
+    log_notify_stats();
+    bt_hids_disconnected(&hids_obj, conn);
+    bt_conn_unref(active_conn);
+    active_conn = NULL;
+    update_sender();
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    ARG_UNUSED(timeout);
+
+    if (conn == active_conn)
+    {
+        notify_stats.interval_us = BT_CONN_INTERVAL_TO_US(interval);
+    }
+
+    LOG_DBG("Connection interval: %u us, latency: %u", BT_CONN_INTERVAL_TO_US(interval), latency);
+}
+
+/* Connection object released, free for the next central */
+static void recycled(void)
+{
+    k_work_submit(&adv_work);
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+    .connected = connected,
+    .disconnected = disconnected,
+    .recycled = recycled,
+    .le_param_updated = le_param_updated,
+};
+
+static int advertising_start(void)
+{
+    int err = bt_le_adv_start(BT_LE_ADV_CONN_FAST_1, ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+
+    /* Stacks before Zephyr 4.0 resume connectable advertising on their own */
+    return err == -EALREADY ? 0 : err;
+}
+
+static void adv_work_fn(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    int err = advertising_start();
+
+    if (err)
+    {
+        LOG_ERR("Advertising failed to restart: %d", err);
+    }
+}
+
+static int hids_init(void)
+{
+    struct bt_hids_init_param hids_init_param = {0};
+    struct bt_hids_inp_rep *input_rep;
+    struct bt_hids_feat_rep *feature_rep;
+
+    hids_init_param.rep_map.data = hid_report_desc;
+    hids_init_param.rep_map.size = sizeof(hid_report_desc);
+
+    hids_init_param.info.bcd_hid = 0x0111;
+    hids_init_param.info.b_country_code = 0x00;
+    hids_init_param.info.flags = (BT_HIDS_REMOTE_WAKE | BT_HIDS_NORMALLY_CONNECTABLE);
+
+    input_rep = &hids_init_param.inp_rep_group_init.reports[INPUT_REP_WHEEL_IDX];
+    input_rep->size = sizeof(struct ble_wheel_report_t);
+    input_rep->id = SCROLLER_WHEEL_REPORT_ID;
+    hids_init_param.inp_rep_group_init.cnt++;
+
+    feature_rep = &hids_init_param.feat_rep_group_init.reports[FEATURE_REP_RES_MULT_IDX];
+    feature_rep->size = SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE;
+    feature_rep->id = SCROLLER_RESOLUTION_MULTIPLIER_REPORT_ID;
+    feature_rep->handler = res_mult_handler;
+    hids_init_param.feat_rep_group_init.cnt++;
+
+#ifdef CONFIG_SCROLLER_LATENCY_STATS
+    feature_rep = &hids_init_param.feat_rep_group_init.reports[FEATURE_REP_LATENCY_IDX];
+    feature_rep->size = SCROLLER_LATENCY_REPORT_SIZE;
+    feature_rep->id = SCROLLER_LATENCY_REPORT_ID;
+    feature_rep->handler = latency_handler;
+    hids_init_param.feat_rep_group_init.cnt++;
+#endif
+
+    return bt_hids_init(&hids_obj, &hids_init_param);
+}
+
+static int init()
+{
+    int err;
+
+    k_work_init_delayable(&idle_work, idle_work_fn);
+    k_work_init(&adv_work, adv_work_fn);
+
+    err = hids_init();
+    if (err)
+    {
+        LOG_ERR("HIDS init failed: %d", err);
+        return err;
+    }
+
+    err = bt_enable(NULL);
+    if (err)
+    {
+        LOG_ERR("Bluetooth init failed: %d", err);
+        return err;
+    }
+
+    if (IS_ENABLED(CONFIG_SETTINGS))
+    {
+        settings_load();
+    }
+
+    err = advertising_start();
+    if (err)
+    {
+        LOG_ERR("Advertising failed to start: %d", err);
+        return err;
+    }
+
+    k_thread_create(&ble_thread, ble_thread_stack, K_THREAD_STACK_SIZEOF(ble_thread_stack),
+                    (k_thread_entry_t)ble_thread_fn, NULL, NULL, NULL,
+                    SCROLLER_SEND_THREAD_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&ble_thread, "ble_sender");
+    k_thread_suspend(&ble_thread);
+
+    return 0;
+}
+
+static void process_module_state_event(struct module_state_event *event)
+{
+    int err;
+
+    if (check_state(event, MODULE_ID(main), MODULE_STATE_READY))
+    {
+        err = init();
+        if (err)
+        {
+            module_set_state(MODULE_STATE_ERROR);
+            LOG_ERR("BLE init err: %d", err);
+        }
+        else
+        {
+            module_set_state(MODULE_STATE_READY);
+        }
+    }
+}
+
+static void process_usb_state_event(struct usb_state_event *event)
+{
+    bool was_sending = sending;
+
+    usb_configured = (event->state == USB_STATE_CONFIGURED);
+    update_sender();
+
+    /* USB powers down the sensor when it goes away, keep it awake for BLE */
+    if (was_sending && sending)
+    {
+        struct wake_up_event *wake_event = new_wake_up_event();
+        APP_EVENT_SUBMIT(wake_event);
+    }
+}
+
+static bool app_event_handler(const struct app_event_header *aeh)
+{
+    if (is_module_state_event(aeh))
+    {
+        struct module_state_event *event = cast_module_state_event(aeh);
+        process_module_state_event(event);
+    }
+    else if (is_usb_state_event(aeh))
+    {
+        struct usb_state_event *event = cast_usb_state_event(aeh);
+        process_usb_state_event(event);
+    }
+
+    /* Don't consume the event */
+    return false;
+}
+APP_EVENT_LISTENER(MODULE, app_event_handler);
+APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
+APP_EVENT_SUBSCRIBE(MODULE, usb_state_event);
@@ -0,0 +1,26 @@
+#ifndef SCROLLER_BLE_H
+#define SCROLLER_BLE_H
+
+#include <stdint.h>
+
+/* Notification statistics of the current connection, kept after it ends until the next one */
+struct ble_notify_stats
+{
+    /* Notifications sent */
+    uint32_t reports;
+    /* Connection events from the first notification to the last, both included */
+    uint32_t events;
+    /* Submit to sent latency */
+    uint32_t latency_min_us;
+    uint32_t latency_avg_us;
+    uint32_t latency_max_us;
+};
+
+/**
+ * @brief Read the notification statistics.
+ *
+ * @param stats Output for the statistics
+ */
+void ble_notify_stats_get(struct ble_notify_stats *stats);
+
+#endif /* SCROLLER_BLE_H */
@@ -0,0 +1,255 @@
+#include "scroller_calibration.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(scroller_calibration, LOG_LEVEL_INF);
+
+#include "scroller_linearize.h"
+#ifdef CONFIG_SCROLLER_SETTINGS
+#include <string.h>
+#include <zephyr/settings/settings.h>
+#endif
+
+/* Settings key of the persisted tables */
+#define SETTINGS_CALIBRATION_KEY "scroller/calib/tables"
+
+/* Persisted tables, with a bit per axis holding a valid table */
+struct calibration_blob
+{
+    uint32_t valid;
+    struct linearize_table tables[SCROLL_AXIS_COUNT];
+};
+
+/* Tables in use. Written by the settings load before sampling starts, after that only by the sensor thread */
+static struct calibration_blob calibration;
+
+/* Recording, sensor thread only */
+static struct linearize_builder builder;
+static int recording_axis = -1;
+static uint32_t recording_start_cycles;
+
+/* Requests from the shell, picked up by the sensor thread on its next sample.
+ * A start holds the revolutions shifted by 8 and the axis plus one.
+ */
+static atomic_t start_request = ATOMIC_INIT(0);
+static atomic_t clear_request = ATOMIC_INIT(0);
+
+/* Last outcome per axis, for the shell */
+static int results[SCROLL_AXIS_COUNT];
+
+#ifdef CONFIG_SCROLLER_SETTINGS
+/* Latest copy taken by the sensor thread, and the one the system workqueue is writing to
+ * flash. A save while a write runs only replaces the latest, the work runs again for it.
+ */
+static struct calibration_blob save_blob;
+static struct calibration_blob write_blob;
+static struct k_spinlock save_lock;
+
+static void save_work_fn(struct k_work *work)
+{
+    k_spinlock_key_t key = k_spin_lock(&save_lock);
+
+    write_blob = save_blob;
+    k_spin_unlock(&save_lock, key);
+
+    int err = settings_save_one(SETTINGS_CALIBRATION_KEY, &write_blob, sizeof(write_blob));
+
+    if (err)
+    {
+        LOG_ERR("Calibration save failed: %d", err);
+    }
+}
+
+static K_WORK_DEFINE(save_work, save_work_fn);
+
+static void save(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&save_lock);
+
+    save_blob = calibration;
+    k_spin_unlock(&save_lock, key);
+
+    k_work_submit(&save_work);
+}
+
+/* Only axes that exist, with corrections a calibration can produce */
+static bool blob_valid(const struct calibration_blob *blob)
+{
+    if (blob->valid & ~BIT_MASK(SCROLL_AXIS_COUNT))
+    {
+        return false;
+    }
+
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        if (!(blob->valid & BIT(axis)))
+        {
+            continue;
+        }
+
+        for (int point = 0; point < LINEARIZE_POINTS; point++)
+        {
+            if (!IN_RANGE(blob->tables[axis].correction_q4[point], -LINEARIZE_MAX_CORRECTION * 16,
+                          LINEARIZE_MAX_CORRECTION * 16))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static int calibration_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    struct calibration_blob blob;
+    ssize_t read;
+
+    if (strcmp(name, "tables") != 0)
+    {
+        return -ENOENT;
+    }
+
+    /* Ignore tables saved by a build with a different layout */
+    if (len != sizeof(blob))
+    {
+        return -EINVAL;
+    }
+
+    read = read_cb(cb_arg, &blob, sizeof(blob));
+    if (read < 0)
+    {
+        return read;
+    }
+
+    if (read != sizeof(blob) || !blob_valid(&blob))
+    {
+        LOG_WRN("Saved calibration out of range, running uncalibrated");
+        return -EINVAL;
+    }
+
+    calibration = blob;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(scroller_calib, "scroller/calib", NULL, calibration_set, NULL, NULL);
+#else
+static void save(void)
+{
+}
+#endif
+
+/* Largest correction of a table, in counts */
+static int32_t table_peak(const struct linearize_table *table)
+{
+    int32_t peak = 0;
+
+    for (int point = 0; point < LINEARIZE_POINTS; point++)
+    {
+        int32_t magnitude = abs(table->correction_q4[point]);
+
+        peak = MAX(peak, magnitude);
+    }
+
+    return (peak + 8) / 16;
+}
+
+static void take_requests(void)
+{
+    atomic_val_t clear = atomic_clear(&clear_request);
+
+    if (clear)
+    {
+        calibration.valid &= ~(uint32_t)clear;
+        save();
+    }
+
+    atomic_val_t start = atomic_clear(&start_request);
+
+    if (start)
+    {
+        recording_axis = (start & 0xFF) - 1;
+        recording_start_cycles = k_cycle_get_32();
+        linearize_builder_start(&builder, start >> 8);
+        LOG_INF("Calibrating axis %d, spin the wheel slowly and steadily for %d revolutions", recording_axis,
+                (int)(start >> 8));
+    }
+}
+
+/* Feed the recording, install and save the table once it's complete */
+static void record(enum scroll_axis axis, int32_t position)
+{
+    struct linearize_table table;
+    /* The timeout counts from the request, the recording itself from the first motion */
+    uint32_t elapsed_us = k_cyc_to_us_floor32(k_cycle_get_32() - recording_start_cycles);
+
+    if (elapsed_us > CONFIG_SCROLLER_CALIBRATION_TIMEOUT_S * USEC_PER_SEC)
+    {
+        results[axis] = -ETIMEDOUT;
+        recording_axis = -1;
+        LOG_WRN("Calibration of axis %d timed out", axis);
+        return;
+    }
+
+    if (!linearize_builder_add(&builder, position, elapsed_us))
+    {
+        return;
+    }
+
+    recording_axis = -1;
+    results[axis] = linearize_builder_finish(&builder, &table);
+    if (results[axis])
+    {
+        LOG_WRN("Calibration of axis %d failed: %d", axis, results[axis]);
+        return;
+    }
+
+    calibration.tables[axis] = table;
+    calibration.valid |= BIT(axis);
+    save();
+
+    LOG_INF("Axis %d calibrated, peak correction %d counts", axis, table_peak(&table));
+}
+
+const struct linearize_table *calibration_process(enum scroll_axis axis, int32_t position)
+{
+    take_requests();
+
+    if (recording_axis == axis)
+    {
+        record(axis, position);
+    }
+
+    return (calibration.valid & BIT(axis)) ? &calibration.tables[axis] : NULL;
+}
+
+int calibration_start(enum scroll_axis axis, uint32_t revolutions)
+{
+    if (recording_axis >= 0 || !atomic_cas(&start_request, 0, (atomic_val_t)((revolutions << 8) | (axis + 1))))
+    {
+        return -EBUSY;
+    }
+
+    return 0;
+}
+
+void calibration_clear(enum scroll_axis axis)
+{
+    atomic_or(&clear_request, BIT(axis));
+}
+
+void calibration_status_get(struct calibration_status *status)
+{
+    status->recording = recording_axis;
+
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        status->valid[axis] = calibration.valid & BIT(axis);
+        status->peak[axis] = status->valid[axis] ? table_peak(&calibration.tables[axis]) : 0;
+        status->result[axis] = results[axis];
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef SCROLLER_CALIBRATION_H
+#define SCROLLER_CALIBRATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scroller_config.h"
+
+struct linearize_table;
+
+/* Calibration state per axis */
+struct calibration_status
+{
+    /* Axis being recorded, -1 for none */
+    int8_t recording;
+    /* A correction table is applied */
+    bool valid[SCROLL_AXIS_COUNT];
+    /* Largest correction of the table, in counts */
+    int32_t peak[SCROLL_AXIS_COUNT];
+    /* Outcome of the last calibration, 0 or a negative errno */
+    int result[SCROLL_AXIS_COUNT];
+};
+
+#ifdef CONFIG_SCROLLER_CALIBRATION
+/**
+ * @brief Record a raw position and look up the correction of its axis.
+ *
+ * Called from the sensor thread for every sample before the scroll engine. Feeds a
+ * running calibration with the raw position and returns the axis table, applied by the
+ * engine.
+ *
+ * @param axis     Axis of the sample
+ * @param position Raw sensor position
+ * @return Correction table of the axis, NULL for none
+ */
+const struct linearize_table *calibration_process(enum scroll_axis axis, int32_t position);
+
+/**
+ * @brief Start a calibration.
+ *
+ * Picked up on the next sample of the axis. The wheel has to be spun slowly at a steady
+ * speed for the revolutions, the table is applied and saved once they are recorded.
+ *
+ * @param axis        Axis to calibrate
+ * @param revolutions Revolutions to record
+ * @return 0 on success, -EBUSY while a calibration runs
+ */
+int calibration_start(enum scroll_axis axis, uint32_t revolutions);
+
+/**
+ * @brief Remove the correction table of an axis, saved as well.
+ *
+ * @param axis Axis
+ */
+void calibration_clear(enum scroll_axis axis);
+
+/**
+ * @brief Read the calibration state.
+ *
+ * @param status Output for the state
+ */
+void calibration_status_get(struct calibration_status *status);
+#else
+static inline const struct linearize_table *calibration_process(enum scroll_axis axis, int32_t position)
+{
+    (void)axis;
+    (void)position;
+
+    return NULL;
+}
+#endif
+
+#endif /* SCROLLER_CALIBRATION_H */
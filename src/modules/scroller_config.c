@@ -0,0 +1,207 @@
+#include "scroller_config.h"
+
+#include <errno.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(scroller_config, LOG_LEVEL_INF);
+#ifdef CONFIG_SCROLLER_SETTINGS
+#include <string.h>
+#include <zephyr/settings/settings.h>
+#endif
+
+/* Settings key of the persisted tuning */
+#define SETTINGS_TUNING_KEY "scroller/tuning"
+
+/* Config snapshots. Readers use the active slot, writers fill the other slot and swap */
+static struct scroller_config_t config_slots[2] = {
+    SCROLLER_CONFIG_DEFAULTS,
+    SCROLLER_CONFIG_DEFAULTS,
+};
+static atomic_ptr_t active_config = ATOMIC_PTR_INIT(&config_slots[0]);
+
+/* Incremented on every publish, lets readers detect a slot being reused under them */
+static atomic_t config_generation = ATOMIC_INIT(0);
+
+/* Serializes writers only, readers never take it */
+static struct k_spinlock writer_lock;
+
+void scroller_config_get(struct scroller_config_t *config)
+{
+    atomic_val_t generation;
+
+    /* Retry if two publishes reused the slot while it was being copied */
+    do
+    {
+        generation = atomic_get(&config_generation);
+        *config = *(const struct scroller_config_t *)atomic_ptr_get(&active_config);
+    } while (generation != atomic_get(&config_generation));
+}
+
+struct scroller_config_t *scroller_config_edit(k_spinlock_key_t *key)
+{
+    *key = k_spin_lock(&writer_lock);
+
+    struct scroller_config_t *active = atomic_ptr_get(&active_config);
+    struct scroller_config_t *draft = (active == &config_slots[0]) ? &config_slots[1] : &config_slots[0];
+
+    *draft = *active;
+
+    return draft;
+}
+
+void scroller_config_commit(k_spinlock_key_t key)
+{
+    struct scroller_config_t *active = atomic_ptr_get(&active_config);
+    struct scroller_config_t *draft = (active == &config_slots[0]) ? &config_slots[1] : &config_slots[0];
+
+    atomic_ptr_set(&active_config, draft);
+    atomic_inc(&config_generation);
+
+    k_spin_unlock(&writer_lock, key);
+}
+
+void scroller_config_set_hi_res(bool hi_res)
+{
+    k_spinlock_key_t key;
+    struct scroller_config_t *config = scroller_config_edit(&key);
+
+    /* Published atomically, the scroll engine picks it up on its next sample */
+    config->hi_res = hi_res;
+    config->internal_divider = hi_res ? config->tuning.hi_res_divider : config->tuning.low_res_divider;
+    scroller_config_commit(key);
+}
+
+/* One multiplier field of the Resolution Multiplier feature report */
+#define RES_MULT_FIELD_MASK BIT_MASK(SCROLLER_RESOLUTION_MULTIPLIER_REPORT_BITS)
+
+int scroller_config_set_res_mult(const uint8_t *report, size_t len)
+{
+    if (len < SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE)
+    {
+        return -EINVAL;
+    }
+
+    uint16_t fields = sys_get_le16(report);
+    uint8_t wheel = fields & RES_MULT_FIELD_MASK;
+    uint8_t pan = (fields >> SCROLLER_RESOLUTION_MULTIPLIER_REPORT_BITS) & RES_MULT_FIELD_MASK;
+
+    if ((wheel > 0) != (pan > 0))
+    {
+        LOG_WRN("Wheel and pan multipliers differ (%u, %u), following the wheel", wheel, pan);
+    }
+
+    scroller_config_set_hi_res(wheel > 0);
+
+    return 0;
+}
+
+void scroller_config_get_res_mult(uint8_t *report)
+{
+    uint16_t field = scroller_config_is_hi_res() ? 1 : 0;
+
+    sys_put_le16(field | (field << SCROLLER_RESOLUTION_MULTIPLIER_REPORT_BITS), report);
+}
+
+bool scroller_config_is_hi_res(void)
+{
+    struct scroller_config_t config;
+
+    scroller_config_get(&config);
+
+    return config.hi_res;
+}
+
+void scroller_config_set_tuning(const struct scroller_tuning_t *tuning)
+{
+    k_spinlock_key_t key;
+    struct scroller_config_t *config = scroller_config_edit(&key);
+
+    config->tuning = *tuning;
+    config->internal_divider = config->hi_res ? tuning->hi_res_divider : tuning->low_res_divider;
+    scroller_config_commit(key);
+}
+
+#ifdef CONFIG_SCROLLER_SETTINGS
+/* Saved tuning within the ranges the shell accepts */
+static bool tuning_valid(const struct scroller_tuning_t *tuning)
+{
+    uint8_t accel;
+
+    /* The bool is checked as stored, anything but 0 or 1 isn't a valid bool */
+    memcpy(&accel, &tuning->accel_enabled, sizeof(accel));
+
+    return IN_RANGE(tuning->low_res_divider, SCROLLER_TUNING_DIVIDER_MIN, SCROLLER_TUNING_DIVIDER_MAX) &&
+           IN_RANGE(tuning->hi_res_divider, SCROLLER_TUNING_DIVIDER_MIN, SCROLLER_TUNING_DIVIDER_MAX) &&
+           IN_RANGE(tuning->sample_period_ms, SCROLLER_TUNING_PERIOD_MIN_MS, SCROLLER_TUNING_PERIOD_MAX_MS) &&
+           IN_RANGE(tuning->filter_deadband, 0, SCROLLER_TUNING_DEADBAND_MAX) && accel <= 1 &&
+           !(accel && IS_ENABLED(CONFIG_SCROLLER_ACCEL_NONE));
+}
+
+static int tuning_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+    struct scroller_tuning_t tuning;
+    ssize_t read;
+
+    if (strcmp(name, "tuning") != 0)
+    {
+        return -ENOENT;
+    }
+
+    /* Ignore settings saved by a build with a different layout */
+    if (len != sizeof(tuning))
+    {
+        return -EINVAL;
+    }
+
+    read = read_cb(cb_arg, &tuning, sizeof(tuning));
+    if (read < 0)
+    {
+        return read;
+    }
+
+    /* A zero divider would divide by zero in the scroll engine */
+    if (read != sizeof(tuning) || !tuning_valid(&tuning))
+    {
+        LOG_WRN("Saved tuning out of range, keeping the defaults");
+        return -EINVAL;
+    }
+
+    scroller_config_set_tuning(&tuning);
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(scroller, "scroller", NULL, tuning_set, NULL, NULL);
+
+int scroller_config_load(void)
+{
+    int err = settings_subsys_init();
+
+    if (err)
+    {
+        return err;
+    }
+
+    return settings_load_subtree("scroller");
+}
+
+int scroller_config_save(void)
+{
+    struct scroller_config_t config;
+
+    scroller_config_get(&config);
+
+    return settings_save_one(SETTINGS_TUNING_KEY, &config.tuning, sizeof(config.tuning));
+}
+#else
+int scroller_config_load(void)
+{
+    return 0;
+}
+
+int scroller_config_save(void)
+{
+    return -ENOTSUP;
+}
+#endif
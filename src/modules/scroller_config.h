@@ -1,6 +1,9 @@
 #ifndef SCROLLER_CONFIG_H
 #define SCROLLER_CONFIG_H
 
+#include <zephyr/devicetree.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/util.h>
 #include <zephyr/usb/class/hid.h>
 #include "hid_extensions.h"
 
@@ -13,28 +16,206 @@
 /* Report Frequency (ms) */
 #define SCROLLER_REPORT_FREQUENCY 5
 
+/* USB HID device and the host polling interval of its IN endpoint (ms) */
+#define SCROLLER_HID_NODE DT_NODELABEL(hid_dev_0)
+#define SCROLLER_POLL_INTERVAL_MS (DT_PROP(SCROLLER_HID_NODE, in_polling_period_us) / 1000)
+
+/* Horizontal wheel sensor, the AC Pan axis is only sampled when the node is enabled */
+#define SCROLLER_PAN_NODE DT_NODELABEL(as5600_pan)
+#define SCROLLER_HAS_PAN DT_NODE_HAS_STATUS(SCROLLER_PAN_NODE, okay)
+
+/* Sensor manager event descriptions of the two wheels */
+#define SCROLLER_WHEEL_SENSOR_DESCR "step"
+#define SCROLLER_PAN_SENSOR_DESCR "pan"
+
+/* Scroll axes, both are carried in the wheel input report */
+enum scroll_axis
+{
+    SCROLL_AXIS_WHEEL,
+    SCROLL_AXIS_PAN,
+    SCROLL_AXIS_COUNT,
+};
+
 /* Default step scaling values */
 #define SCROLLER_STEPS_LOW_RES 120
 #define SCROLLER_STEPS_HI_RES 1
 
+/* Default sampling period (ms). The fast period when sampling adaptively, otherwise the fixed
+ * RTIO period. The CAF sensor manager period is fixed in sensor_manager_def.h.
+ */
+#if defined(CONFIG_SCROLLER_SAMPLE_ADAPTIVE)
+#define SCROLLER_SAMPLE_PERIOD_DEFAULT_MS CONFIG_SCROLLER_SAMPLE_PERIOD_FAST_MS
+#elif defined(CONFIG_SCROLLER_ACQUIRE_PERIOD_MS)
+#define SCROLLER_SAMPLE_PERIOD_DEFAULT_MS CONFIG_SCROLLER_ACQUIRE_PERIOD_MS
+#else
+#define SCROLLER_SAMPLE_PERIOD_DEFAULT_MS 5
+#endif
+
+/* Runtime tunable settings, persisted with the settings subsystem */
+struct scroller_tuning_t
+{
+    /* Position change per step with the host in low and high resolution mode */
+    int32_t low_res_divider;
+    int32_t hi_res_divider;
+    /* Sampling period (ms), RTIO acquisition only */
+    uint32_t sample_period_ms;
+    /* Rest jitter deadband (counts), 0 disables the filter */
+    int32_t filter_deadband;
+    /* Apply the build time acceleration curve */
+    bool accel_enabled;
+};
+
+/* Accepted tuning ranges, from the shell and from saved settings */
+#define SCROLLER_TUNING_DIVIDER_MIN 1
+#define SCROLLER_TUNING_DIVIDER_MAX INT16_MAX
+#define SCROLLER_TUNING_PERIOD_MIN_MS 1
+#define SCROLLER_TUNING_PERIOD_MAX_MS 1000
+#define SCROLLER_TUNING_DEADBAND_MAX 64
+
+#define SCROLLER_TUNING_DEFAULTS                                  \
+    {                                                             \
+        .low_res_divider = SCROLLER_STEPS_LOW_RES,                \
+        .hi_res_divider = SCROLLER_STEPS_HI_RES,                  \
+        .sample_period_ms = SCROLLER_SAMPLE_PERIOD_DEFAULT_MS,    \
+        .filter_deadband = CONFIG_SCROLLER_FILTER_DEADBAND,       \
+        .accel_enabled = !IS_ENABLED(CONFIG_SCROLLER_ACCEL_NONE), \
+    }
+
 /* Scroller config */
 struct scroller_config_t
 {
-    int32_t scroll_accumulator;
+    /* Divider in use, follows the host resolution multiplier */
     int32_t internal_divider;
+    /* Host enabled high resolution scrolling */
+    bool hi_res;
+    struct scroller_tuning_t tuning;
 };
-extern struct scroller_config_t SCROLLER_CONFIG;
-extern struct k_mutex scroller_config_mutex;
+
+#define SCROLLER_CONFIG_DEFAULTS                    \
+    {                                               \
+        .internal_divider = SCROLLER_STEPS_LOW_RES, \
+        .hi_res = false,                            \
+        .tuning = SCROLLER_TUNING_DEFAULTS,         \
+    }
+
+/**
+ * @brief Copy the current config snapshot.
+ *
+ * Lock free, safe from any context. Read once per sample so that changes apply at a
+ * sample boundary.
+ *
+ * @param config Output for the snapshot
+ */
+void scroller_config_get(struct scroller_config_t *config);
+
+/**
+ * @brief Start editing the config.
+ *
+ * Serializes writers and returns a draft initialized from the current snapshot. Must be
+ * followed by scroller_config_commit without blocking in between.
+ *
+ * @param key Output for the writer lock key
+ * @return Draft config to modify
+ */
+struct scroller_config_t *scroller_config_edit(k_spinlock_key_t *key);
+
+/**
+ * @brief Publish the draft config and release the writer lock.
+ *
+ * @param key Writer lock key from scroller_config_edit
+ */
+void scroller_config_commit(k_spinlock_key_t key);
+
+/**
+ * @brief Apply the host's Resolution Multiplier feature report.
+ *
+ * @param hi_res Report value greater than 0, the host scrolls in high resolution steps
+ */
+void scroller_config_set_hi_res(bool hi_res);
+
+/**
+ * @brief Apply the host's Resolution Multiplier feature report.
+ *
+ * The report carries the wheel and pan multipliers in consecutive 7 bit fields. Both axes
+ * share one divider, it follows the wheel field.
+ *
+ * @param report Report data after the report id
+ * @param len    Length of the report data
+ * @return 0 on success, -EINVAL if the report is too short
+ */
+int scroller_config_set_res_mult(const uint8_t *report, size_t len);
+
+/**
+ * @brief Fill the Resolution Multiplier feature report, both fields with the current mode.
+ *
+ * @param report Output for SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE bytes after the report id
+ */
+void scroller_config_get_res_mult(uint8_t *report);
+
+/**
+ * @brief Publish new tuning settings.
+ *
+ * The divider in use is updated for the current host resolution mode.
+ *
+ * @param tuning Settings to publish
+ */
+void scroller_config_set_tuning(const struct scroller_tuning_t *tuning);
+
+/**
+ * @brief Load the persisted tuning settings.
+ *
+ * @return 0 on success, negative errno otherwise
+ */
+int scroller_config_load(void);
+
+/**
+ * @brief Persist the current tuning settings.
+ *
+ * @return 0 on success, negative errno otherwise
+ */
+int scroller_config_save(void);
+
+/**
+ * @brief Check if the host enabled high resolution scrolling.
+ *
+ * @return true if high resolution steps are emitted
+ */
+bool scroller_config_is_hi_res(void);
 
 /*-- HID REPORT --*/
 
+#define SCROLLER_WHEEL_REPORT_ID 1
+#define SCROLLER_RESOLUTION_MULTIPLIER_REPORT_ID 2
+
 #define SCROLLER_RESOLUTION_MULTIPLIER 128
 #define SCROLLER_RESOLUTION_MULTIPLIER_REPORT_BITS 7
+/* Wheel and pan multiplier fields, bytes after the report id */
+#define SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE DIV_ROUND_UP(2 * SCROLLER_RESOLUTION_MULTIPLIER_REPORT_BITS, 8)
 #define SCROLLER_L_MIN_L8 0x00
 #define SCROLLER_L_MIN_H8 0x80
 #define SCROLLER_L_MAX_L8 0xFF
 #define SCROLLER_L_MAX_H8 0x7F
 #define SCROLLER_WHEEL_INPUT 0b00001110 /* Data, Var, Abs, Wrap */
+
+/* Vendor latency statistics feature report, see scroller_latency.h */
+#define SCROLLER_LATENCY_REPORT_ID 3
+#define SCROLLER_LATENCY_REPORT_SIZE 84 /* Bytes after the report id */
+#ifdef CONFIG_SCROLLER_LATENCY_STATS
+#define HID_LATENCY_REPORT_DESC_ITEMS                                                                       \
+    HID_USAGE_PAGE16(0x00, 0xFF), /* Vendor Defined */                                                      \
+        HID_USAGE(0x01),                                                                                    \
+        HID_COLLECTION(HID_COLLECTION_APPLICATION),                                                         \
+        HID_REPORT_ID(SCROLLER_LATENCY_REPORT_ID), /* Feature Report for latency statistics */              \
+        HID_USAGE(0x01),                                                                                    \
+        HID_LOGICAL_MIN8(0),                                                                                \
+        HID_LOGICAL_MAX16(0xFF, 0x00),                                                                      \
+        HID_REPORT_SIZE(8),                                                                                 \
+        HID_REPORT_COUNT(SCROLLER_LATENCY_REPORT_SIZE),                                                     \
+        HID_FEATURE(0b00000010), /* Data, Var, Abs */                                                       \
+        HID_END_COLLECTION,
+#else
+#define HID_LATENCY_REPORT_DESC_ITEMS
+#endif
 /**
  * @brief Define HID Wheel Report Descriptor.
  *
@@ -88,6 +269,7 @@ extern struct k_mutex scroller_config_mutex;
         HID_END_COLLECTION,                                                                                 \
         HID_END_COLLECTION,                                                                                 \
         HID_END_COLLECTION,                                                                                 \
+        HID_LATENCY_REPORT_DESC_ITEMS                                                                       \
     }
 
 #endif /* SCROLLER_CONFIG_H */
\ No newline at end of file
@@ -5,101 +5,338 @@
 #include <zephyr/device.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/drivers/i2c.h>
+#include <zephyr/pm/device.h>
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_DBG);
 
 #include <caf/events/power_event.h>
 #include <zephyr/drivers/sensor/ams_as5600.h>
 
+#include "scroller_idle_waker.h"
+#include "scroller_scroll_calculate.h"
+#include "scroller_profile.h"
+
 #define MODULE_INIT_VAR MODULE##_init
 static bool MODULE_INIT_VAR = false;
 
-static struct k_timer wake_up_timer;
-static struct k_work wake_up_work;
+#define STEP_SENSOR DT_NODELABEL(as5600)
+
+/* Configuration register low byte, power mode in bits 1:0 */
+#define AS5600_REG_CONF_L 0x08
+#define AS5600_CONF_PM_MASK 0x03
+#define AS5600_PM_LPM1 1
+#define AS5600_PM_LPM2 2
+#define AS5600_PM_LPM3 3
+
+/* No reference position yet */
+#define NO_REFERENCE INT32_MIN
+
+static const struct device *sensor = DEVICE_DT_GET(STEP_SENSOR);
+static const struct device *i2c_dev = DEVICE_DT_GET(DT_BUS(STEP_SENSOR));
+static const struct i2c_dt_spec as5600_i2c = I2C_DT_SPEC_GET(STEP_SENSOR);
 
-static struct sensor_value delta = {
-    .val1 = 0xFF000000,
-    .val2 = 0,
+/* AS5600 power mode per tier. The sensor's own polling time (5, 20 and 100 ms) has to stay
+ * below the poll interval of the tier, the current is the datasheet typical.
+ */
+static const struct
+{
+    uint32_t min_poll_ms;
+    uint8_t power_mode;
+    uint16_t sensor_current_ua;
+} idle_tiers[IDLE_TIER_COUNT] = {
+    [IDLE_TIER_LPM1] = {.min_poll_ms = 0, .power_mode = AS5600_PM_LPM1, .sensor_current_ua = 3400},
+    [IDLE_TIER_LPM2] = {.min_poll_ms = 20, .power_mode = AS5600_PM_LPM2, .sensor_current_ua = 1800},
+    [IDLE_TIER_LPM3] = {.min_poll_ms = 100, .power_mode = AS5600_PM_LPM3, .sensor_current_ua = 1500},
 };
 
-extern void idle_waker_callback(struct k_timer *timer_id)
+static struct k_work_delayable wake_up_work;
+/* Polling while powered down */
+static bool idle;
+
+/* Position the motion threshold is measured from */
+static int32_t reference = NO_REFERENCE;
+/* Current poll interval, doubled every CONFIG_SCROLLER_IDLE_POLLS_PER_STEP still polls */
+static uint32_t poll_ms;
+static uint32_t polls_at_interval;
+/* Tier and sensor power mode currently programmed */
+static enum idle_tier tier;
+static uint8_t power_mode;
+/* Start of the previous poll, bounds when the detected motion started */
+static uint32_t prev_poll_cycles;
+
+static struct idle_tier_stats tier_stats[IDLE_TIER_COUNT];
+static struct k_spinlock stats_lock;
+
+void idle_waker_stats_get(struct idle_tier_stats stats[IDLE_TIER_COUNT])
 {
-    k_work_submit(&wake_up_work);
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+    for (int i = 0; i < IDLE_TIER_COUNT; i++)
+    {
+        stats[i] = tier_stats[i];
+
+        uint64_t idle_us = (uint64_t)stats[i].idle_ms * USEC_PER_MSEC;
+        uint64_t active_ua = idle_us ? (uint64_t)CONFIG_SCROLLER_IDLE_ACTIVE_CURRENT_UA * stats[i].active_us / idle_us : 0;
+
+        stats[i].avg_current_ua = idle_tiers[i].sensor_current_ua + (uint32_t)active_ua;
+    }
+
+    k_spin_unlock(&stats_lock, key);
 }
 
-static void wake_up_work_callback(struct k_work *work)
+static void log_stats(void)
+{
+    struct idle_tier_stats stats[IDLE_TIER_COUNT];
+
+    idle_waker_stats_get(stats);
+
+    for (int i = 0; i < IDLE_TIER_COUNT; i++)
+    {
+        if (stats[i].polls == 0)
+        {
+            continue;
+        }
+
+        LOG_INF("LPM%d: polls: %u, errors: %u, idle: %u ms, wakes: %u, wake latency (us) avg: %u, max: %u, "
+                "avg current: %u uA",
+                idle_tiers[i].power_mode, stats[i].polls, stats[i].errors, stats[i].idle_ms, stats[i].wakes,
+                stats[i].wakes ? (uint32_t)(stats[i].wake_latency_total_us / stats[i].wakes) : 0,
+                stats[i].wake_latency_max_us, stats[i].avg_current_ua);
+    }
+}
+
+/* Program the AS5600 power mode, bypassing the driver which only applies it at init */
+static int set_power_mode(uint8_t mode)
 {
-    const struct device *sensor;
-    // Check i2c pheripheral state:
-    const struct device *i2c_dev = DEVICE_DT_GET(DT_NODELABEL(i2c0));
     int err;
 
-    if (!device_is_ready(i2c_dev))
+    if (mode == power_mode)
     {
-        printk("I2C0 device is not ready\n");
+        return 0;
     }
 
-    sensor = DEVICE_DT_GET(DT_NODELABEL(as5600));
-    if (!device_is_ready(sensor))
+    err = i2c_reg_update_byte_dt(&as5600_i2c, AS5600_REG_CONF_L, AS5600_CONF_PM_MASK, mode);
+    if (err)
+    {
+        LOG_WRN("Power mode %u not set (%d)", mode, err);
+        return err;
+    }
+
+    power_mode = mode;
+
+    return 0;
+}
+
+/* Suspend the bus between polls, nothing else uses it while idle */
+static void bus_suspend(bool suspend)
+{
+    if (!IS_ENABLED(CONFIG_SCROLLER_IDLE_BUS_SUSPEND))
     {
-        LOG_ERR("Sensor not ready");
         return;
     }
 
-    err = sensor_sample_fetch_chan(sensor, AS5600_SENSOR_CHAN_FILTERED_STEPS);
-    if (err < 0)
+    int err = pm_device_action_run(i2c_dev, suspend ? PM_DEVICE_ACTION_SUSPEND : PM_DEVICE_ACTION_RESUME);
+
+    if (err && err != -EALREADY)
+    {
+        LOG_WRN("Bus %s failed (%d)", suspend ? "suspend" : "resume", err);
+    }
+}
+
+static enum idle_tier tier_for_interval(uint32_t interval_ms)
+{
+    enum idle_tier t = IDLE_TIER_LPM1;
+
+    while (t + 1 < IDLE_TIER_COUNT && interval_ms >= idle_tiers[t + 1].min_poll_ms)
+    {
+        t++;
+    }
+
+    return t;
+}
+
+/* Exponential backoff of the poll interval, dropping the sensor into deeper power modes */
+static void backoff(void)
+{
+    if (++polls_at_interval < CONFIG_SCROLLER_IDLE_POLLS_PER_STEP || poll_ms >= CONFIG_SCROLLER_IDLE_POLL_MAX_MS)
     {
-        LOG_ERR("Could not fetch samples (%d)", err);
         return;
     }
 
+    polls_at_interval = 0;
+    poll_ms = MIN(poll_ms * 2, CONFIG_SCROLLER_IDLE_POLL_MAX_MS);
+
+    enum idle_tier next = tier_for_interval(poll_ms);
+
+    if (next != tier && set_power_mode(idle_tiers[next].power_mode) == 0)
+    {
+        LOG_DBG("Idle poll %u ms, LPM%u", poll_ms, idle_tiers[next].power_mode);
+        tier = next;
+    }
+}
+
+/* Read the angle, repeating a failed read and recovering the bus once the retries are spent */
+static int fetch(struct sensor_value *reading)
+{
+    int err;
+
+    for (int attempt = 0; attempt <= CONFIG_SCROLLER_I2C_RETRIES; attempt++)
+    {
+        err = sensor_sample_fetch_chan(sensor, AS5600_SENSOR_CHAN_FILTERED_STEPS);
+        profile_reads(1);
+        if (!err)
+        {
+            err = sensor_channel_get(sensor, AS5600_SENSOR_CHAN_FILTERED_STEPS, reading);
+        }
+        if (!err)
+        {
+            return 0;
+        }
+    }
+
+    LOG_WRN("Could not fetch samples (%d), recovering the bus", err);
+
+    int recover_err = i2c_recover_bus(i2c_dev);
+
+    if (recover_err)
+    {
+        LOG_WRN("Bus recovery failed (%d)", recover_err);
+    }
+
+    return err;
+}
+
+/* Returns 1 when motion was detected and replayed, 0 when still and a negative error when
+ * the sensor couldn't be read. The reference is kept across failed polls.
+ */
+static int poll(void)
+{
     struct sensor_value reading;
-    err = sensor_channel_get(sensor, AS5600_SENSOR_CHAN_FILTERED_STEPS, &reading);
+    int err;
+
+    err = fetch(&reading);
     if (err < 0)
     {
-        LOG_ERR("Could not get samples (%d)", err);
+        return err;
     }
-    LOG_INF("Pos: %d", reading.val1);
 
     // If not initialized the grab an initial position and return
-    if (delta.val1 == 0xFF000000)
+    if (reference == NO_REFERENCE)
     {
         LOG_INF("Set initial reading: %d", reading.val1);
-        delta = reading;
-        return;
+        reference = reading.val1;
+        return 0;
     }
 
-    // 10 step threshold:
-    int change = abs(delta.val1 - reading.val1);
-    if (change > 10)
+    int change = abs(reference - reading.val1);
+    if (change <= CONFIG_SCROLLER_IDLE_WAKE_THRESHOLD)
     {
-        LOG_WRN("Change detectect: %d", change);
+        return 0;
+    }
+
+    /* Sampling is stopped, replay the motion so the first steps go out with the wake up */
+    scroll_process_position(SCROLL_AXIS_WHEEL, reading.val1);
+
+    LOG_WRN("Change detected: %d", change);
+
+    return 1;
+}
+
+static void wake_up_work_callback(struct k_work *work)
+{
+    uint32_t start = k_cycle_get_32();
+
+    bus_suspend(false);
+    int moved = poll();
+    bus_suspend(true);
+
+    uint32_t end = k_cycle_get_32();
 
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    struct idle_tier_stats *stats = &tier_stats[tier];
+
+    stats->polls++;
+    stats->idle_ms += poll_ms;
+    stats->active_us += k_cyc_to_us_ceil32(end - start);
+
+    if (moved < 0)
+    {
+        stats->errors++;
+    }
+    else if (moved)
+    {
+        uint32_t latency_us = k_cyc_to_us_ceil32(end - prev_poll_cycles);
+
+        stats->wakes++;
+        stats->wake_latency_total_us += latency_us;
+        stats->wake_latency_max_us = MAX(stats->wake_latency_max_us, latency_us);
+    }
+    k_spin_unlock(&stats_lock, key);
+
+    prev_poll_cycles = start;
+
+    if (moved > 0)
+    {
         struct wake_up_event *event = new_wake_up_event();
         APP_EVENT_SUBMIT(event);
+        return;
+    }
+
+    // keep sleeping, a failed poll doesn't show the wheel still so it doesn't back off
+    if (!moved)
+    {
+        backoff();
     }
-    // keep sleeping
+    k_work_reschedule(&wake_up_work, K_MSEC(poll_ms));
 }
 
 static int init()
 {
-    k_timer_init(&wake_up_timer, idle_waker_callback, NULL);
-    k_work_init(&wake_up_work, wake_up_work_callback);
+    if (!device_is_ready(sensor))
+    {
+        LOG_ERR("Sensor not ready");
+        return -ENODEV;
+    }
+
+    k_work_init_delayable(&wake_up_work, wake_up_work_callback);
+    power_mode = DT_PROP(STEP_SENSOR, power_mode);
+
+    MODULE_INIT_VAR = true;
 
     return 0;
 }
 
 static void process_power_down_event(struct power_down_event *event)
 {
-    LOG_INF("Starting idle timer");
-    k_timer_start(&wake_up_timer, K_MSEC(500), K_MSEC(1000));
+    LOG_INF("Starting idle polling");
+    idle = true;
+
+    reference = NO_REFERENCE;
+    poll_ms = CONFIG_SCROLLER_IDLE_POLL_MIN_MS;
+    polls_at_interval = 0;
+    tier = tier_for_interval(poll_ms);
+    prev_poll_cycles = k_cycle_get_32();
+
+    set_power_mode(idle_tiers[tier].power_mode);
+    k_work_reschedule(&wake_up_work, K_MSEC(poll_ms));
 }
 
 static void process_wake_up_event(struct wake_up_event *event)
 {
-    LOG_INF("Idle timer stopped");
-    k_timer_stop(&wake_up_timer);
-    delta.val1 = 0xFF000000;
+    if (!idle)
+    {
+        return;
+    }
+
+    LOG_INF("Idle polling stopped");
+    idle = false;
+    k_work_cancel_delayable(&wake_up_work);
+
+    /* Back to the devicetree power mode for sampling */
+    bus_suspend(false);
+    set_power_mode(DT_PROP(STEP_SENSOR, power_mode));
+
+    log_stats();
 }
 
 static void process_module_state_event(struct module_state_event *event)
@@ -151,4 +388,4 @@ static bool app_event_handler(const struct app_event_header *aeh)
 APP_EVENT_LISTENER(MODULE, app_event_handler);
 APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
 APP_EVENT_SUBSCRIBE(MODULE, power_down_event);
-APP_EVENT_SUBSCRIBE(MODULE, wake_up_event);
\ No newline at end of file
+APP_EVENT_SUBSCRIBE(MODULE, wake_up_event);
@@ -0,0 +1,42 @@
+#ifndef SCROLLER_IDLE_WAKER_H
+#define SCROLLER_IDLE_WAKER_H
+
+#include <stdint.h>
+
+/* Idle tiers, the AS5600 low power mode used while polling at that backoff */
+enum idle_tier
+{
+    IDLE_TIER_LPM1,
+    IDLE_TIER_LPM2,
+    IDLE_TIER_LPM3,
+    IDLE_TIER_COUNT,
+};
+
+/* Per tier idle statistics */
+struct idle_tier_stats
+{
+    /* Polls made in the tier */
+    uint32_t polls;
+    /* Time spent idle in the tier */
+    uint32_t idle_ms;
+    /* Time the bus and CPU were active polling */
+    uint32_t active_us;
+    /* Wake ups detected in the tier */
+    uint32_t wakes;
+    /* Polls still failing after the retries, each followed by a bus recovery */
+    uint32_t errors;
+    /* Previous poll to replayed motion, an upper bound on the wake latency */
+    uint32_t wake_latency_max_us;
+    uint64_t wake_latency_total_us;
+    /* Estimated average current, sensor plus polling */
+    uint32_t avg_current_ua;
+};
+
+/**
+ * @brief Copy the idle statistics.
+ *
+ * @param stats One entry per idle tier.
+ */
+void idle_waker_stats_get(struct idle_tier_stats stats[IDLE_TIER_COUNT]);
+
+#endif /* SCROLLER_IDLE_WAKER_H */
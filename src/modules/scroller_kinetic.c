@@ -0,0 +1,179 @@
+#include "scroller_kinetic.h"
+
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#ifdef CONFIG_TIMING_FUNCTIONS
+#include <zephyr/timing/timing.h>
+#endif
+
+#include "scroller_config.h"
+#include "scroller_step_accumulator.h"
+
+/* Integrator tick, one per host poll */
+#define KINETIC_TICK_US (SCROLLER_POLL_INTERVAL_MS * USEC_PER_MSEC)
+
+/* Coasting stops once the velocity has decayed to this fraction of the flick velocity */
+#define KINETIC_STOP_SHIFT 4
+
+/* Tracked velocity while the wheel moves, sensor thread only.
+ * Counts per second for flick detection, Q16 steps per tick for the coast.
+ */
+static int32_t track_counts_per_s;
+static int32_t track_steps_q16;
+
+/* Coast state, shared between the sensor thread and the timer */
+static struct k_spinlock lock;
+static bool coasting;
+static int32_t coast_velocity_q16;
+static int32_t coast_stop_q16;
+static int32_t coast_remainder_q16;
+
+static struct kinetic_stats stats;
+
+/* A tick takes a few microseconds, the kernel cycle counter runs from the 32 kHz RTC on the
+ * nRF52. The DWT is used when timing functions are available.
+ */
+static uint64_t tick_begin(void)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    return timing_counter_get();
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+static uint32_t tick_elapsed_ns(uint64_t start)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_t from = start;
+    timing_t to = timing_counter_get();
+
+    return (uint32_t)timing_cycles_to_ns(timing_cycles_get(&from, &to));
+#else
+    return (uint32_t)k_cyc_to_ns_ceil64((uint32_t)k_cycle_get_32() - (uint32_t)start);
+#endif
+}
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+/* Counter running before the first coast, the profiler starting it again is harmless */
+static int kinetic_timing_init(void)
+{
+    timing_init();
+    timing_start();
+
+    return 0;
+}
+SYS_INIT(kinetic_timing_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif
+
+/* Integrator tick, emits the whole steps covered this tick and applies the friction */
+static void kinetic_tick(struct k_timer *timer_id);
+K_TIMER_DEFINE(kinetic_timer, kinetic_tick, NULL);
+
+static void kinetic_tick(struct k_timer *timer_id)
+{
+    uint64_t start = tick_begin();
+    int32_t steps = 0;
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (coasting)
+    {
+        int32_t position_q16 = coast_remainder_q16 + coast_velocity_q16;
+
+        steps = position_q16 / (1 << 16);
+        coast_remainder_q16 = position_q16 - steps * (1 << 16);
+
+        /* Friction, velocity *= 1 - friction */
+        coast_velocity_q16 -= (int32_t)((int64_t)coast_velocity_q16 * CONFIG_SCROLLER_KINETIC_FRICTION / 1000);
+
+        if (abs(coast_velocity_q16) <= coast_stop_q16)
+        {
+            coasting = false;
+            k_timer_stop(timer_id);
+        }
+
+        stats.steps += abs(steps);
+    }
+
+    k_spin_unlock(&lock, key);
+
+    step_accumulator_put(SCROLL_AXIS_WHEEL, steps);
+
+    stats.max_tick_ns = MAX(stats.max_tick_ns, tick_elapsed_ns(start));
+}
+
+static bool cancel_coast(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    bool was_coasting = coasting;
+
+    coasting = false;
+    k_spin_unlock(&lock, key);
+
+    if (was_coasting)
+    {
+        k_timer_stop(&kinetic_timer);
+    }
+
+    return was_coasting;
+}
+
+void kinetic_sample(int16_t delta, int16_t steps, uint32_t dt_us)
+{
+    if (dt_us == 0)
+    {
+        return;
+    }
+
+    if (abs(delta) >= CONFIG_SCROLLER_KINETIC_MOTION_THRESHOLD)
+    {
+        /* Any motion, opposing or stopping, takes over from the coast */
+        if (cancel_coast())
+        {
+            stats.cancelled++;
+            track_counts_per_s = 0;
+            track_steps_q16 = 0;
+        }
+
+        /* Smooth the velocity over a few samples */
+        int32_t counts_per_s = (int32_t)((int64_t)delta * USEC_PER_SEC / dt_us);
+        int32_t steps_q16 = (int32_t)(((int64_t)steps << 16) * KINETIC_TICK_US / dt_us);
+
+        track_counts_per_s += (counts_per_s - track_counts_per_s) / 4;
+        track_steps_q16 += (steps_q16 - track_steps_q16) / 4;
+
+        return;
+    }
+
+    /* The wheel came to rest, coast if it was released fast enough */
+    if (abs(track_counts_per_s) >= CONFIG_SCROLLER_KINETIC_FLICK_VELOCITY && track_steps_q16 != 0)
+    {
+        k_spinlock_key_t key = k_spin_lock(&lock);
+
+        coasting = true;
+        coast_velocity_q16 = track_steps_q16;
+        coast_stop_q16 = abs(track_steps_q16) >> KINETIC_STOP_SHIFT;
+        coast_remainder_q16 = 0;
+        stats.coasts++;
+
+        k_spin_unlock(&lock, key);
+
+        k_timer_start(&kinetic_timer, K_USEC(KINETIC_TICK_US), K_USEC(KINETIC_TICK_US));
+    }
+
+    track_counts_per_s = 0;
+    track_steps_q16 = 0;
+}
+
+void kinetic_stop(void)
+{
+    cancel_coast();
+    track_counts_per_s = 0;
+    track_steps_q16 = 0;
+}
+
+void kinetic_stats_get(struct kinetic_stats *out)
+{
+    *out = stats;
+}
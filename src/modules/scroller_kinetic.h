@@ -0,0 +1,43 @@
+#ifndef SCROLLER_KINETIC_H
+#define SCROLLER_KINETIC_H
+
+#include <stdint.h>
+
+/* Kinetic scrolling statistics */
+struct kinetic_stats
+{
+    /* Coasts started after a flick */
+    uint32_t coasts;
+    /* Coasts cancelled by wheel motion */
+    uint32_t cancelled;
+    /* Steps emitted while coasting */
+    uint32_t steps;
+    /* Worst case cost of one integrator tick */
+    uint32_t max_tick_ns;
+};
+
+/**
+ * @brief Feed a sample to the kinetic engine.
+ *
+ * Called from the sensor thread for every sample. Motion cancels any coast and updates the
+ * tracked velocity, the wheel coming to rest after a flick starts a coast.
+ *
+ * @param delta Unscaled position change of the sample
+ * @param steps Steps emitted for the sample
+ * @param dt_us Time since the previous sample
+ */
+void kinetic_sample(int16_t delta, int16_t steps, uint32_t dt_us);
+
+/**
+ * @brief Stop any coast immediately.
+ */
+void kinetic_stop(void);
+
+/**
+ * @brief Read the kinetic scrolling statistics.
+ *
+ * @param stats Output for the statistics
+ */
+void kinetic_stats_get(struct kinetic_stats *stats);
+
+#endif /* SCROLLER_KINETIC_H */
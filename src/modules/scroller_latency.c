@@ -0,0 +1,214 @@
+#include "scroller_latency.h"
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#ifdef CONFIG_TIMING_FUNCTIONS
+#include <zephyr/timing/timing.h>
+#endif
+
+#include "scroller_config.h"
+
+/* Descriptor report count must match the report layout */
+BUILD_ASSERT(sizeof(struct latency_report_t) == SCROLLER_LATENCY_REPORT_SIZE + 1);
+
+/* Stage timestamps of one sample */
+struct latency_trace
+{
+    uint64_t stamps[LATENCY_STAGE_COUNT];
+    bool valid;
+};
+
+/* Sample being produced, sample whose steps are waiting in the accumulator,
+ * and sample in the report being sent.
+ */
+static struct latency_trace candidate;
+static struct latency_trace pending;
+static struct latency_trace inflight;
+
+/* Accumulated statistics */
+static uint32_t count;
+static uint32_t min_us = UINT32_MAX;
+static uint32_t max_us;
+static uint64_t stage_total_us[LATENCY_STAGE_COUNT - 1];
+static uint32_t buckets[LATENCY_BUCKET_COUNT];
+
+/* Stages are marked from the sensor thread, the sender and the USB interrupt */
+static struct k_spinlock lock;
+
+/* The kernel cycle counter runs from the 32 kHz RTC on the nRF52, about 30 us per count.
+ * The DWT is used when timing functions are available.
+ */
+static uint64_t stamp_now(void)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    return timing_counter_get();
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+static uint32_t stamps_to_us(uint64_t from, uint64_t to)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_t start = from;
+    timing_t end = to;
+
+    return (uint32_t)(timing_cycles_to_ns(timing_cycles_get(&start, &end)) / NSEC_PER_USEC);
+#else
+    return k_cyc_to_us_floor32((uint32_t)to - (uint32_t)from);
+#endif
+}
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+/* Counter running before the first sample, other users starting it again is harmless */
+static int latency_timing_init(void)
+{
+    timing_init();
+    timing_start();
+
+    return 0;
+}
+SYS_INIT(latency_timing_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif
+
+/* Add the completed trace to the statistics */
+static void record(const struct latency_trace *trace)
+{
+    uint32_t total_us = stamps_to_us(trace->stamps[LATENCY_STAGE_FETCH],
+                                     trace->stamps[LATENCY_STAGE_IN_COMPLETE]);
+    uint32_t bucket = MIN(total_us / CONFIG_SCROLLER_LATENCY_BUCKET_US, LATENCY_BUCKET_COUNT - 1);
+
+    for (int stage = LATENCY_STAGE_CALCULATE; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        stage_total_us[stage - 1] += stamps_to_us(trace->stamps[stage - 1], trace->stamps[stage]);
+    }
+
+    min_us = MIN(min_us, total_us);
+    max_us = MAX(max_us, total_us);
+    buckets[bucket]++;
+    count++;
+}
+
+void latency_mark(enum latency_stage stage)
+{
+    uint64_t now = stamp_now();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    switch (stage)
+    {
+    case LATENCY_STAGE_FETCH:
+        candidate.stamps[LATENCY_STAGE_FETCH] = now;
+        candidate.valid = true;
+        break;
+
+    case LATENCY_STAGE_CALCULATE:
+        candidate.stamps[LATENCY_STAGE_CALCULATE] = now;
+        /* Only the oldest sample in a report is traced */
+        if (candidate.valid && !pending.valid)
+        {
+            pending = candidate;
+        }
+        candidate.valid = false;
+        break;
+
+    case LATENCY_STAGE_DEQUEUE:
+        inflight = pending;
+        inflight.stamps[LATENCY_STAGE_DEQUEUE] = now;
+        pending.valid = false;
+        break;
+
+    case LATENCY_STAGE_EP_WRITE:
+        inflight.stamps[LATENCY_STAGE_EP_WRITE] = now;
+        break;
+
+    case LATENCY_STAGE_IN_COMPLETE:
+        if (inflight.valid)
+        {
+            inflight.stamps[LATENCY_STAGE_IN_COMPLETE] = now;
+            record(&inflight);
+            inflight.valid = false;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    k_spin_unlock(&lock, key);
+}
+
+/* Upper edge of the bucket the percentile falls in */
+static uint32_t percentile_us(uint32_t percent)
+{
+    uint64_t target = DIV_ROUND_UP((uint64_t)count * percent, 100);
+    uint64_t cumulative = 0;
+
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++)
+    {
+        cumulative += buckets[i];
+        if (cumulative >= target)
+        {
+            /* The overflow bucket has no upper edge, use the max */
+            return (i == LATENCY_BUCKET_COUNT - 1) ? max_us : (i + 1) * CONFIG_SCROLLER_LATENCY_BUCKET_US;
+        }
+    }
+
+    return max_us;
+}
+
+void latency_stats_get(struct latency_stats *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    stats->count = count;
+    stats->min_us = count ? min_us : 0;
+    stats->max_us = max_us;
+    stats->p99_us = count ? percentile_us(99) : 0;
+
+    for (int i = 0; i < LATENCY_STAGE_COUNT - 1; i++)
+    {
+        stats->stage_avg_us[i] = count ? (uint32_t)(stage_total_us[i] / count) : 0;
+    }
+
+    memcpy(stats->buckets, buckets, sizeof(stats->buckets));
+
+    k_spin_unlock(&lock, key);
+}
+
+void latency_report_fill(struct latency_report_t *report)
+{
+    struct latency_stats stats;
+
+    latency_stats_get(&stats);
+
+    report->report_id = SCROLLER_LATENCY_REPORT_ID;
+    report->count = stats.count;
+    report->min_us = MIN(stats.min_us, UINT16_MAX);
+    report->max_us = MIN(stats.max_us, UINT16_MAX);
+    report->p99_us = MIN(stats.p99_us, UINT16_MAX);
+    report->bucket_us = CONFIG_SCROLLER_LATENCY_BUCKET_US;
+
+    for (int i = 0; i < LATENCY_STAGE_COUNT - 1; i++)
+    {
+        report->stage_avg_us[i] = MIN(stats.stage_avg_us[i], UINT16_MAX);
+    }
+
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++)
+    {
+        report->buckets[i] = MIN(stats.buckets[i], UINT16_MAX);
+    }
+}
+
+void latency_stats_reset(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    count = 0;
+    min_us = UINT32_MAX;
+    max_us = 0;
+    memset(stage_total_us, 0, sizeof(stage_total_us));
+    memset(buckets, 0, sizeof(buckets));
+
+    k_spin_unlock(&lock, key);
+}
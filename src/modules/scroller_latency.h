@@ -0,0 +1,95 @@
+#ifndef SCROLLER_LATENCY_H
+#define SCROLLER_LATENCY_H
+
+#include <stdint.h>
+
+/* Pipeline stages a sample passes through, in order */
+enum latency_stage
+{
+    /* Angle read from the sensor. On the CAF sensor manager path the sensor event is
+     * timestamped when it is dispatched, the event manager delay isn't included
+     */
+    LATENCY_STAGE_FETCH,
+    /* Steps calculated and put in the step accumulator */
+    LATENCY_STAGE_CALCULATE,
+    /* Steps taken from the step accumulator by the sender */
+    LATENCY_STAGE_DEQUEUE,
+    /* Report written to the HID interrupt endpoint */
+    LATENCY_STAGE_EP_WRITE,
+    /* Host collected the report */
+    LATENCY_STAGE_IN_COMPLETE,
+
+    LATENCY_STAGE_COUNT,
+};
+
+/* Histogram buckets of sample to IN completion latency, the last bucket collects overflow */
+#define LATENCY_BUCKET_COUNT 32
+
+/* Latency statistics */
+struct latency_stats
+{
+    /* Reports measured */
+    uint32_t count;
+    /* Sample to IN completion latency */
+    uint32_t min_us;
+    uint32_t max_us;
+    /* Upper edge of the bucket holding the 99th percentile */
+    uint32_t p99_us;
+    /* Mean time from the previous stage to each stage after the fetch */
+    uint32_t stage_avg_us[LATENCY_STAGE_COUNT - 1];
+    uint32_t buckets[LATENCY_BUCKET_COUNT];
+};
+
+/* Latency vendor feature report */
+struct __packed latency_report_t
+{
+    uint8_t report_id;
+    uint32_t count;
+    uint16_t min_us;
+    uint16_t max_us;
+    uint16_t p99_us;
+    uint16_t bucket_us;
+    uint16_t stage_avg_us[LATENCY_STAGE_COUNT - 1];
+    /* Saturating bucket counts */
+    uint16_t buckets[LATENCY_BUCKET_COUNT];
+};
+
+/**
+ * @brief Timestamp a pipeline stage.
+ *
+ * Fetch and calculate are marked by the producer for each sample. The first sample
+ * whose steps start a new report is traced through the remaining stages, and its
+ * total latency is added to the histogram on IN completion. Calculate must only be
+ * marked for samples that produced steps.
+ *
+ * @param stage Stage reached
+ */
+#ifdef CONFIG_SCROLLER_LATENCY_STATS
+void latency_mark(enum latency_stage stage);
+#else
+static inline void latency_mark(enum latency_stage stage)
+{
+    (void)stage;
+}
+#endif
+
+/**
+ * @brief Read the latency statistics.
+ *
+ * @param stats Output for the statistics
+ */
+void latency_stats_get(struct latency_stats *stats);
+
+/**
+ * @brief Fill the latency vendor feature report.
+ *
+ * @param report Output for the report
+ */
+void latency_report_fill(struct latency_report_t *report);
+
+/**
+ * @brief Clear the latency statistics.
+ */
+void latency_stats_reset(void);
+
+#endif /* SCROLLER_LATENCY_H */
@@ -0,0 +1,152 @@
+#include "scroller_linearize.h"
+
+#include <errno.h>
+#include <string.h>
+
+int32_t linearize_apply(const struct linearize_table *table, int32_t position)
+{
+    uint32_t index = (uint32_t)position / LINEARIZE_SPACING;
+    int32_t frac = (uint32_t)position % LINEARIZE_SPACING;
+    int32_t low = table->correction_q4[index % LINEARIZE_POINTS];
+    int32_t high = table->correction_q4[(index + 1) % LINEARIZE_POINTS];
+    int32_t correction_q4 = low + (high - low) * frac / LINEARIZE_SPACING;
+
+    /* Rounded to the nearest count */
+    return (position + ((correction_q4 + 8) >> 4)) & (SCROLL_ENGINE_COUNTS - 1);
+}
+
+void linearize_builder_start(struct linearize_builder *builder, int32_t revolutions)
+{
+    memset(builder, 0, sizeof(*builder));
+    builder->revolutions = revolutions;
+}
+
+/* Track the revolution times once the distance passes the next whole revolution */
+static void count_revolution(struct linearize_builder *builder)
+{
+    int32_t distance = builder->travelled < 0 ? -builder->travelled : builder->travelled;
+
+    if (distance < (builder->completed + 1) * SCROLL_ENGINE_COUNTS)
+    {
+        return;
+    }
+
+    uint32_t duration_us = builder->time_us - builder->revolution_end_us;
+
+    if (!builder->completed || duration_us < builder->revolution_min_us)
+    {
+        builder->revolution_min_us = duration_us;
+    }
+    if (!builder->completed || duration_us > builder->revolution_max_us)
+    {
+        builder->revolution_max_us = duration_us;
+    }
+
+    builder->completed++;
+    builder->revolution_end_us = builder->time_us;
+}
+
+bool linearize_builder_add(struct linearize_builder *builder, int32_t position, uint32_t time_us)
+{
+    if (!builder->started)
+    {
+        builder->started = true;
+        builder->prev_position = position;
+
+        return false;
+    }
+
+    int32_t delta = position - builder->prev_position;
+
+    /* Handle wrapping the zero point */
+    if (delta >= SCROLL_ENGINE_COUNTS / 2)
+    {
+        delta -= SCROLL_ENGINE_COUNTS;
+    }
+    else if (delta < -SCROLL_ENGINE_COUNTS / 2)
+    {
+        delta += SCROLL_ENGINE_COUNTS;
+    }
+
+    if (!builder->moving)
+    {
+        /* Still at rest, the rest position stays the reference */
+        if (delta >= -LINEARIZE_MOTION_COUNTS && delta <= LINEARIZE_MOTION_COUNTS)
+        {
+            return false;
+        }
+
+        /* The first motion is where distance and time start */
+        builder->moving = true;
+        builder->start_us = time_us;
+        delta = 0;
+    }
+
+    builder->travelled += delta;
+    builder->prev_position = position;
+    builder->time_us = time_us - builder->start_us;
+
+    /* Nearest correction point */
+    uint32_t point = ((uint32_t)position + LINEARIZE_SPACING / 2) / LINEARIZE_SPACING % LINEARIZE_POINTS;
+
+    builder->travelled_sum[point] += builder->travelled;
+    builder->time_sum[point] += builder->time_us;
+    builder->samples[point]++;
+
+    count_revolution(builder);
+
+    return builder->completed >= builder->revolutions;
+}
+
+int linearize_builder_finish(const struct linearize_builder *builder, struct linearize_table *table)
+{
+    int64_t total = builder->travelled;
+    int64_t duration = builder->time_us;
+    int32_t error_q8[LINEARIZE_POINTS];
+    int64_t mean_q8 = 0;
+
+    if (!total || !duration)
+    {
+        return -ENODATA;
+    }
+
+    /* A spin that sped up or slowed down puts the speed change into the table */
+    if ((uint64_t)(builder->revolution_max_us - builder->revolution_min_us) * 100 >
+        (uint64_t)builder->revolution_min_us * LINEARIZE_MAX_SPEED_VARIATION)
+    {
+        return -EINVAL;
+    }
+
+    /* Mean distance at each point against a steady spin over the mean time there */
+    for (int point = 0; point < LINEARIZE_POINTS; point++)
+    {
+        int64_t samples = builder->samples[point];
+
+        if (!samples)
+        {
+            return -ENODATA;
+        }
+
+        int64_t expected_q8 = builder->time_sum[point] * total * 256 / duration;
+
+        error_q8[point] = (int32_t)((builder->travelled_sum[point] * 256 - expected_q8) / samples);
+        mean_q8 += error_q8[point];
+    }
+    mean_q8 /= LINEARIZE_POINTS;
+
+    for (int point = 0; point < LINEARIZE_POINTS; point++)
+    {
+        /* Rounded to the nearest Q4 count */
+        int32_t correction_q8 = (int32_t)(mean_q8 - error_q8[point]);
+        int32_t correction_q4 = (correction_q8 + (correction_q8 < 0 ? -8 : 8)) / 16;
+
+        if (correction_q4 > LINEARIZE_MAX_CORRECTION * 16 || correction_q4 < -LINEARIZE_MAX_CORRECTION * 16)
+        {
+            return -ERANGE;
+        }
+
+        table->correction_q4[point] = (int16_t)correction_q4;
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef SCROLLER_LINEARIZE_H
+#define SCROLLER_LINEARIZE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scroller_scroll_engine.h"
+
+/* Correction points over a revolution, evenly spaced */
+#define LINEARIZE_POINTS 64
+#define LINEARIZE_SPACING (SCROLL_ENGINE_COUNTS / LINEARIZE_POINTS)
+
+/* Largest correction a calibration may produce, anything beyond was not a steady spin */
+#define LINEARIZE_MAX_CORRECTION 64
+
+/* Position change from rest that starts the recording, rest jitter stays below it */
+#define LINEARIZE_MOTION_COUNTS 2
+
+/* Largest difference between the slowest and the fastest revolution, in percent of the fastest */
+#define LINEARIZE_MAX_SPEED_VARIATION 10
+
+/* Position correction table. Holds no kernel objects so it can be built and applied on the host */
+struct linearize_table
+{
+    /* Q4 counts added to a position at each point, interpolated in between */
+    int16_t correction_q4[LINEARIZE_POINTS];
+};
+
+/* Calibration recording. Positions are binned by the nearest correction point as sums,
+ * the steady spin speed is only known once the recording ends. Distance and time count
+ * from the first motion, the wheel may rest for a while after the start.
+ */
+struct linearize_builder
+{
+    /* Revolutions to record */
+    int32_t revolutions;
+    /* A position was seen, and the wheel moved away from it */
+    bool started;
+    bool moving;
+    /* Previous raw position, and the wrap corrected distance travelled since the first motion */
+    int32_t prev_position;
+    int32_t travelled;
+    /* Per point sums of the distance travelled and the time of the positions binned there */
+    int64_t travelled_sum[LINEARIZE_POINTS];
+    int64_t time_sum[LINEARIZE_POINTS];
+    uint32_t samples[LINEARIZE_POINTS];
+    /* Time of the first motion, and of the last position since then */
+    uint32_t start_us;
+    uint32_t time_us;
+    /* Revolutions completed, when the last one ended and the shortest and longest */
+    int32_t completed;
+    uint32_t revolution_end_us;
+    uint32_t revolution_min_us;
+    uint32_t revolution_max_us;
+};
+
+/**
+ * @brief Correct a raw position with the table.
+ *
+ * Linear interpolation between the two nearest points, integer only.
+ *
+ * @param table    Correction table
+ * @param position Raw sensor position, 0 to SCROLL_ENGINE_COUNTS - 1
+ * @return Corrected position, 0 to SCROLL_ENGINE_COUNTS - 1
+ */
+int32_t linearize_apply(const struct linearize_table *table, int32_t position);
+
+/**
+ * @brief Start recording a calibration.
+ *
+ * @param builder     Recording state
+ * @param revolutions Revolutions of steady spin to record
+ */
+void linearize_builder_start(struct linearize_builder *builder, int32_t revolutions);
+
+/**
+ * @brief Record a raw position of the calibration spin.
+ *
+ * The wheel has to turn at a steady speed, in either direction, for the whole recording.
+ * Positions within LINEARIZE_MOTION_COUNTS of the first are rest, the recording starts
+ * with the first one beyond.
+ *
+ * @param builder  Recording state
+ * @param position Raw sensor position, 0 to SCROLL_ENGINE_COUNTS - 1
+ * @param time_us  Time of the position, any free running microsecond clock
+ * @return true once the revolutions are recorded
+ */
+bool linearize_builder_add(struct linearize_builder *builder, int32_t position, uint32_t time_us);
+
+/**
+ * @brief Build the correction table from a finished recording.
+ *
+ * The error at each point is the binned distance against the distance a steady spin
+ * covers in the binned time. The mean error is removed, it is only the start offset.
+ *
+ * @param builder Finished recording
+ * @param table   Output table
+ * @return 0 on success, -ENODATA if a point saw no position, -EINVAL if the revolution
+ *         times differ by more than LINEARIZE_MAX_SPEED_VARIATION, -ERANGE if a correction
+ *         exceeds LINEARIZE_MAX_CORRECTION
+ */
+int linearize_builder_finish(const struct linearize_builder *builder, struct linearize_table *table);
+
+#endif /* SCROLLER_LINEARIZE_H */
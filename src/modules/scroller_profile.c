@@ -0,0 +1,306 @@
+#define MODULE scroller_profile
+#include <caf/events/module_state_event.h>
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#ifdef CONFIG_TIMING_FUNCTIONS
+#include <zephyr/timing/timing.h>
+#endif
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_INF);
+
+#include <caf/events/power_event.h>
+
+#include "scroller_profile.h"
+
+/* Bit times of an angle read: address and register write, repeated start, address and
+ * two data bytes, each byte with its ack, plus start and stop
+ */
+#define ANGLE_READ_BITS (5 * 9 + 3)
+#define ANGLE_READ_US (ANGLE_READ_BITS * USEC_PER_SEC / DT_PROP(DT_BUS(DT_NODELABEL(as5600)), clock_frequency))
+
+static const char *const section_names[PROFILE_SECTION_COUNT] = {
+    [PROFILE_SECTION_CALCULATE] = "calculate",
+    [PROFILE_SECTION_DISPATCH] = "dispatch",
+    [PROFILE_SECTION_SEND] = "send",
+};
+
+static const char *const state_names[PROFILE_STATE_COUNT] = {
+    [PROFILE_STATE_ACTIVE] = "active",
+    [PROFILE_STATE_IDLE] = "idle",
+};
+
+/* Closed accounts, and the state currently accounted with its start */
+static struct profile_section_stats sections[PROFILE_SECTION_COUNT];
+static struct profile_state_stats states[PROFILE_STATE_COUNT];
+static enum profile_state state = PROFILE_STATE_ACTIVE;
+static uint64_t state_start_us;
+static uint64_t state_start_busy_us;
+
+/* Sections run in the sensor thread, the event manager and the sender */
+static struct k_spinlock lock;
+
+uint64_t profile_begin(void)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    return timing_counter_get();
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+/* Time since a section timestamp. The kernel cycle counter runs from the 32 kHz RTC on the
+ * nRF52, too coarse for a single section, the DWT is used when timing functions are available
+ */
+static uint32_t elapsed_ns(uint64_t start)
+{
+#ifdef CONFIG_TIMING_FUNCTIONS
+    timing_t from = start;
+    timing_t to = timing_counter_get();
+
+    return (uint32_t)timing_cycles_to_ns(timing_cycles_get(&from, &to));
+#else
+    return (uint32_t)k_cyc_to_ns_floor64((uint32_t)k_cycle_get_32() - (uint32_t)start);
+#endif
+}
+
+void profile_end(enum profile_section section, uint64_t start)
+{
+    uint32_t ns = elapsed_ns(start);
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    sections[section].calls++;
+    sections[section].total_ns += ns;
+    sections[section].max_ns = MAX(sections[section].max_ns, ns);
+
+    k_spin_unlock(&lock, key);
+}
+
+void profile_reads(uint32_t count)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    states[state].reads += count;
+
+    k_spin_unlock(&lock, key);
+}
+
+void profile_report(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    states[state].reports++;
+
+    k_spin_unlock(&lock, key);
+}
+
+static uint64_t now_us(void)
+{
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+/* Non idle CPU time of every thread and interrupt */
+static uint64_t busy_us(void)
+{
+    k_thread_runtime_stats_t stats;
+
+    k_thread_runtime_stats_all_get(&stats);
+
+#ifdef CONFIG_THREAD_RUNTIME_STATS_USE_TIMING_FUNCTIONS
+    return timing_cycles_to_ns(stats.total_cycles) / NSEC_PER_USEC;
+#else
+    return k_cyc_to_us_floor64(stats.total_cycles);
+#endif
+}
+
+/* Idle current all the time, the CPU above it while busy and the TWIM while reading.
+ * uA times us is pC, times mV is fJ.
+ */
+static uint64_t energy_nj(const struct profile_state_stats *account)
+{
+    uint64_t charge_pc = (uint64_t)CONFIG_SCROLLER_PROFILE_IDLE_UA * account->time_us +
+                         (uint64_t)(CONFIG_SCROLLER_PROFILE_CPU_UA - CONFIG_SCROLLER_PROFILE_IDLE_UA) *
+                             account->cpu_us +
+                         (uint64_t)CONFIG_SCROLLER_PROFILE_TWIM_UA * account->twim_us;
+
+    return charge_pc * CONFIG_SCROLLER_PROFILE_SUPPLY_MV / 1000000;
+}
+
+/* Add the time of the current state up to now to an account. Called with the lock held */
+static void account_current(struct profile_state_stats *account, uint64_t now, uint64_t busy)
+{
+    account->time_us += now - state_start_us;
+    account->cpu_us += busy - state_start_busy_us;
+}
+
+void profile_stats_get(struct profile_stats *stats)
+{
+    uint64_t now = now_us();
+    uint64_t busy = busy_us();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    memcpy(stats->sections, sections, sizeof(sections));
+    memcpy(stats->states, states, sizeof(states));
+    account_current(&stats->states[state], now, busy);
+
+    k_spin_unlock(&lock, key);
+
+    for (int i = 0; i < PROFILE_STATE_COUNT; i++)
+    {
+        struct profile_state_stats *account = &stats->states[i];
+
+        account->twim_us = (uint64_t)account->reads * ANGLE_READ_US;
+        account->energy_nj = energy_nj(account);
+    }
+
+    const struct profile_state_stats *active = &stats->states[PROFILE_STATE_ACTIVE];
+    const struct profile_state_stats *idle = &stats->states[PROFILE_STATE_IDLE];
+
+    stats->report_energy_nj = active->reports ? (uint32_t)(active->energy_nj / active->reports) : 0;
+    stats->idle_second_energy_nj =
+        idle->time_us ? (uint32_t)(idle->energy_nj * USEC_PER_SEC / idle->time_us) : 0;
+}
+
+void profile_reset(void)
+{
+    uint64_t now = now_us();
+    uint64_t busy = busy_us();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    memset(sections, 0, sizeof(sections));
+    memset(states, 0, sizeof(states));
+    state_start_us = now;
+    state_start_busy_us = busy;
+
+    k_spin_unlock(&lock, key);
+}
+
+/* Close the account of the current state and start the next */
+static void state_set(enum profile_state next)
+{
+    uint64_t now = now_us();
+    uint64_t busy = busy_us();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    account_current(&states[state], now, busy);
+    state = next;
+    state_start_us = now;
+    state_start_busy_us = busy;
+
+    k_spin_unlock(&lock, key);
+}
+
+static void log_thread(const struct k_thread *cthread, void *user_data)
+{
+    uint64_t all_cycles = *(uint64_t *)user_data;
+    struct k_thread *thread = (struct k_thread *)cthread;
+    k_thread_runtime_stats_t rt;
+    const char *name = k_thread_name_get(thread);
+
+    if (k_thread_runtime_stats_get(thread, &rt) || !rt.execution_cycles)
+    {
+        return;
+    }
+
+    /* Share in tenths of a percent */
+    uint32_t permille = all_cycles ? (uint32_t)(rt.execution_cycles * 1000 / all_cycles) : 0;
+
+    LOG_INF("Thread %s: cycles %llu, cpu %u.%u%%", name ? name : "?", (unsigned long long)rt.execution_cycles,
+            permille / 10, permille % 10);
+}
+
+/* Where the cycles went and what the estimated energy was */
+static void log_stats(void)
+{
+    struct profile_stats stats;
+    k_thread_runtime_stats_t all;
+
+    profile_stats_get(&stats);
+
+    for (int i = 0; i < PROFILE_SECTION_COUNT; i++)
+    {
+        const struct profile_section_stats *section = &stats.sections[i];
+
+        if (!section->calls)
+        {
+            continue;
+        }
+
+        LOG_INF("Section %s: calls %u, avg %u ns, max %u ns", section_names[i], section->calls,
+                (uint32_t)(section->total_ns / section->calls), section->max_ns);
+    }
+
+    for (int i = 0; i < PROFILE_STATE_COUNT; i++)
+    {
+        const struct profile_state_stats *account = &stats.states[i];
+
+        LOG_INF("State %s: %llu ms, cpu %llu us, twim %llu us, reads %u, reports %u, energy %llu uJ",
+                state_names[i], (unsigned long long)(account->time_us / USEC_PER_MSEC),
+                (unsigned long long)account->cpu_us, (unsigned long long)account->twim_us, account->reads,
+                account->reports, (unsigned long long)(account->energy_nj / 1000));
+    }
+
+    LOG_INF("Energy per report: %u nJ, per idle second: %u nJ", stats.report_energy_nj,
+            stats.idle_second_energy_nj);
+
+    k_thread_runtime_stats_all_get(&all);
+    k_thread_foreach(log_thread, &all.execution_cycles);
+}
+
+#ifdef CONFIG_APP_EVENT_MANAGER_POSTPROCESS_HOOKS
+/* Start of the event being dispatched, the event manager dispatches one at a time */
+static uint64_t dispatch_start;
+
+static void dispatch_begin(const struct app_event_header *aeh)
+{
+    ARG_UNUSED(aeh);
+
+    dispatch_start = profile_begin();
+}
+
+static void dispatch_end(const struct app_event_header *aeh)
+{
+    ARG_UNUSED(aeh);
+
+    profile_end(PROFILE_SECTION_DISPATCH, dispatch_start);
+}
+
+/* Outermost hooks so every listener is inside the measurement */
+APP_EVENT_HOOK_PREPROCESS_REGISTER_FIRST(dispatch_begin);
+APP_EVENT_HOOK_POSTPROCESS_REGISTER_LAST(dispatch_end);
+#endif
+
+static bool app_event_handler(const struct app_event_header *aeh)
+{
+    if (is_module_state_event(aeh))
+    {
+        struct module_state_event *event = cast_module_state_event(aeh);
+
+        if (check_state(event, MODULE_ID(main), MODULE_STATE_READY))
+        {
+#ifdef CONFIG_TIMING_FUNCTIONS
+            timing_init();
+            timing_start();
+#endif
+            profile_reset();
+        }
+    }
+    else if (is_power_down_event(aeh))
+    {
+        state_set(PROFILE_STATE_IDLE);
+        log_stats();
+    }
+    else if (is_wake_up_event(aeh))
+    {
+        state_set(PROFILE_STATE_ACTIVE);
+        log_stats();
+    }
+
+    /* Don't consume the event */
+    return false;
+}
+APP_EVENT_LISTENER(MODULE, app_event_handler);
+APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
+APP_EVENT_SUBSCRIBE(MODULE, power_down_event);
+APP_EVENT_SUBSCRIBE(MODULE, wake_up_event);
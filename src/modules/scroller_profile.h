@@ -0,0 +1,125 @@
+#ifndef SCROLLER_PROFILE_H
+#define SCROLLER_PROFILE_H
+
+#include <stdint.h>
+
+/* Hot path sections the CPU time is accounted to */
+enum profile_section
+{
+    /* Raw position to steps in the step accumulator */
+    PROFILE_SECTION_CALCULATE,
+    /* One event through every listener of the event manager, includes the calculation on
+     * the sensor manager path
+     */
+    PROFILE_SECTION_DISPATCH,
+    /* Report built and queued by the sender */
+    PROFILE_SECTION_SEND,
+
+    PROFILE_SECTION_COUNT,
+};
+
+/* Power states the energy is accounted in, switched by wake up and power down */
+enum profile_state
+{
+    PROFILE_STATE_ACTIVE,
+    PROFILE_STATE_IDLE,
+
+    PROFILE_STATE_COUNT,
+};
+
+/* CPU time of a section */
+struct profile_section_stats
+{
+    uint32_t calls;
+    uint64_t total_ns;
+    uint32_t max_ns;
+};
+
+/* Time and estimated energy of a power state */
+struct profile_state_stats
+{
+    /* Time spent in the state */
+    uint64_t time_us;
+    /* Non idle CPU time */
+    uint64_t cpu_us;
+    /* Bus time of the sensor reads, from the bus clock */
+    uint64_t twim_us;
+    uint32_t reads;
+    uint32_t reports;
+    /* Estimated from the configured currents and supply voltage */
+    uint64_t energy_nj;
+};
+
+/* Profiling statistics */
+struct profile_stats
+{
+    struct profile_section_stats sections[PROFILE_SECTION_COUNT];
+    struct profile_state_stats states[PROFILE_STATE_COUNT];
+    /* Active energy per report sent, 0 before any */
+    uint32_t report_energy_nj;
+    /* Idle energy per second, 0 before any idle time */
+    uint32_t idle_second_energy_nj;
+};
+
+#ifdef CONFIG_SCROLLER_PROFILE
+/**
+ * @brief Start timing a section.
+ *
+ * @return Timestamp to pass to profile_end()
+ */
+uint64_t profile_begin(void);
+
+/**
+ * @brief Account the time since profile_begin() to a section.
+ *
+ * @param section Section timed
+ * @param start   Timestamp from profile_begin()
+ */
+void profile_end(enum profile_section section, uint64_t start);
+
+/**
+ * @brief Count sensor reads for the bus time.
+ *
+ * @param count Reads started, failed ones included
+ */
+void profile_reads(uint32_t count);
+
+/**
+ * @brief Count a report handed to the host transport.
+ */
+void profile_report(void);
+#else
+static inline uint64_t profile_begin(void)
+{
+    return 0;
+}
+
+static inline void profile_end(enum profile_section section, uint64_t start)
+{
+    (void)section;
+    (void)start;
+}
+
+static inline void profile_reads(uint32_t count)
+{
+    (void)count;
+}
+
+static inline void profile_report(void)
+{
+}
+#endif
+
+/**
+ * @brief Read the profiling statistics, the current state included up to now.
+ *
+ * @param stats Output for the statistics
+ */
+void profile_stats_get(struct profile_stats *stats);
+
+/**
+ * @brief Clear the section and state statistics.
+ */
+void profile_reset(void);
+
+#endif /* SCROLLER_PROFILE_H */
@@ -0,0 +1,43 @@
+#include "scroller_sample_scheduler.h"
+
+#include <stdlib.h>
+#include <zephyr/sys/util.h>
+
+/* Fast sampling period, tunable at runtime */
+static uint32_t fast_ms = CONFIG_SCROLLER_SAMPLE_PERIOD_FAST_MS;
+/* Current sampling period */
+static uint32_t period_ms = CONFIG_SCROLLER_SAMPLE_PERIOD_FAST_MS;
+/* Consecutive still samples at the current period */
+static uint32_t still_samples;
+
+uint32_t sample_scheduler_reset(uint32_t fast_period_ms)
+{
+    fast_ms = MIN(fast_period_ms, CONFIG_SCROLLER_SAMPLE_PERIOD_SLOW_MS);
+    period_ms = fast_ms;
+    still_samples = 0;
+
+    return period_ms;
+}
+
+uint32_t sample_scheduler_update(int32_t delta)
+{
+    int32_t change = abs(delta);
+
+    if (change >= CONFIG_SCROLLER_SAMPLE_MOTION_THRESHOLD)
+    {
+        /* Moving, sample as fast as possible without waiting */
+        period_ms = fast_ms;
+        still_samples = 0;
+    }
+    else if (change <= CONFIG_SCROLLER_SAMPLE_STILL_THRESHOLD)
+    {
+        /* Still, back off exponentially once the hold count is reached */
+        if (++still_samples >= CONFIG_SCROLLER_SAMPLE_HOLD_SAMPLES)
+        {
+            period_ms = MIN(period_ms * 2, CONFIG_SCROLLER_SAMPLE_PERIOD_SLOW_MS);
+            still_samples = 0;
+        }
+    }
+
+    return period_ms;
+}
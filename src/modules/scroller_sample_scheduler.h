@@ -0,0 +1,27 @@
+#ifndef SCROLLER_SAMPLE_SCHEDULER_H
+#define SCROLLER_SAMPLE_SCHEDULER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Reset the scheduler to the fast sampling period.
+ *
+ * @param fast_period_ms Fast sampling period, capped to the slow period
+ * @return Sampling period in ms
+ */
+uint32_t sample_scheduler_reset(uint32_t fast_period_ms);
+
+/**
+ * @brief Update the sampling period with the latest position change.
+ *
+ * Motion at or above the motion threshold selects the fast period immediately. Once
+ * the change stays at or below the still threshold for the hold count the period is
+ * doubled, backing off to the slow period. Changes between the thresholds keep the
+ * current period.
+ *
+ * @param delta Unscaled position change of the last sample
+ * @return Sampling period in ms
+ */
+uint32_t sample_scheduler_update(int32_t delta);
+
+#endif /* SCROLLER_SAMPLE_SCHEDULER_H */
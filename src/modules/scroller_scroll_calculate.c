@@ -6,82 +6,186 @@
 LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_DBG);
 
 #include "scroller_config.h"
+#include "scroller_scroll_calculate.h"
+#include "scroller_scroll_engine.h"
+#include "scroller_step_accumulator.h"
+#include "scroller_latency.h"
+#include "scroller_kinetic.h"
+#include "scroller_trace.h"
+#include "scroller_calibration.h"
+#include "scroller_profile.h"
+#ifdef CONFIG_CAF_SENSOR_EVENTS
+#include <string.h>
 #include <caf/events/sensor_event.h>
+#endif
 #include <caf/events/power_event.h>
+#ifdef CONFIG_SCROLLER_SAMPLE_STATS
+#include <zephyr/sys/sys_heap.h>
+#endif
 
-/* Message queue for step values to be emitted from the HID device
- * Only has space for 2 values but it should never fill.
+#ifndef CONFIG_SCROLLER_ACCEL_NONE
+/* Build time generated gain table for the selected profile */
+#include "scroller_accel_lut.h"
+
+static const struct scroll_accel_curve accel_curve = {
+    .gain_q8 = scroller_accel_lut,
+    .count = ARRAY_SIZE(scroller_accel_lut),
+    .velocity_step = SCROLLER_ACCEL_LUT_VELOCITY_STEP,
+};
+#endif
+
+/* Scroll engine state per axis, only touched from the sensor thread, or the idle waker while sampling is stopped */
+static struct scroll_engine engines[SCROLL_AXIS_COUNT];
+/* Cycle count of the previous sample of each axis, for the velocity */
+static uint32_t prev_sample_cycles[SCROLL_AXIS_COUNT];
+/* Positions processed per axis */
+static uint32_t axis_samples[SCROLL_AXIS_COUNT];
+
+#ifdef CONFIG_SCROLLER_SAMPLE_STATS
+/* System heap, used by the event manager for every event. Zephyr has no public accessor, this is the heap
+ * kernel/mempool.c defines when CONFIG_HEAP_MEM_POOL_SIZE > 0. Revisit if the kernel renames it.
  */
-K_MSGQ_DEFINE(step_msgq, sizeof(int16_t), 2, 1);
+extern struct k_heap _system_heap;
+
+/* Samples and non idle CPU cycles since the last wake up */
+static struct
+{
+    uint32_t samples;
+    uint64_t start_cycles;
+} sample_stats;
 
-/* Convert raw position to step change */
-int16_t calculate_scroll(int32_t sensor_steps)
+static uint64_t busy_cycles(void)
 {
-    static int16_t prev_steps;
-    int16_t curr_steps = (sensor_steps & 0xFFFF);
+    k_thread_runtime_stats_t stats;
 
-    int16_t delta = prev_steps - curr_steps;
+    k_thread_runtime_stats_all_get(&stats);
+
+    return stats.total_cycles;
+}
+
+/* CPU cost of a sample on the active acquisition path, and the heap high water mark */
+static void log_sample_stats(void)
+{
+    struct sys_memory_stats heap;
 
-    if (!delta)
+    if (sample_stats.samples)
     {
-        return 0;
+        LOG_INF("Cycles per sample: %u, samples: %u",
+                (uint32_t)((busy_cycles() - sample_stats.start_cycles) / sample_stats.samples),
+                sample_stats.samples);
     }
 
-    /* Handle wrapping the zero point */
-    if (delta > 2048)
+    if (!sys_heap_runtime_stats_get(&_system_heap.heap, &heap))
     {
-        delta -= 4096; /* Negative direction wrap */
+        LOG_INF("Heap peak: %zu bytes, allocated: %zu bytes", heap.max_allocated_bytes, heap.allocated_bytes);
     }
-    else if (delta < -2048)
+}
+#endif
+
+/* Time since the previous sample of an axis */
+static uint32_t sample_interval_us(enum scroll_axis axis)
+{
+    uint32_t now = k_cycle_get_32();
+    uint32_t dt_us = k_cyc_to_us_floor32(now - prev_sample_cycles[axis]);
+
+    prev_sample_cycles[axis] = now;
+
+    return dt_us;
+}
+
+/* Pick up filter and acceleration settings tuned from the shell, and the divider the host
+ * selected. Lock free snapshot, changes apply from the next sample
+ */
+static int32_t apply_tuning(struct scroll_engine *engine)
+{
+    struct scroller_config_t config;
+
+    scroller_config_get(&config);
+
+    engine->filter.deadband = config.tuning.filter_deadband;
+#ifndef CONFIG_SCROLLER_ACCEL_NONE
+    engine->accel = config.tuning.accel_enabled ? &accel_curve : NULL;
+#endif
+
+    return config.internal_divider;
+}
+
+void scroll_stats_get(struct scroll_stats *stats)
+{
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
     {
-        delta += 4096; /* Positive direction wrap */
+        stats->samples[axis] = axis_samples[axis];
+        stats->suppressed[axis] = engines[axis].filter.suppressed;
+        stats->clamped[axis] = engines[axis].clamped;
     }
+}
 
-    /* Invert scroll direction */
-    delta *= -1;
-
-    // FIXME: Move to local to avoid the global lock. Plus only needed here.
-    /* Lock the global config while manipulating */
-    k_mutex_lock(&scroller_config_mutex, K_FOREVER);
-    SCROLLER_CONFIG.scroll_accumulator += delta;
+/* Convert a raw position and hand the steps to the sender */
+int16_t scroll_process_position(enum scroll_axis axis, int32_t sensor_steps)
+{
+    uint64_t profile_start = profile_begin();
 
-    /*
-     * Apply an internal scroll accumulator. The linux kernel only supports down to
-     * (int)(steps * 120 / RES MULT) resulting a maximum of 120 steps per detent. Fractional
-     * scrolling is not supported. The sensor emits 4096/120 ~34 detents per revolution
-     * which is high.
-     */
+    struct scroll_engine *engine = &engines[axis];
+    int32_t divider = apply_tuning(engine);
+    uint32_t clamped = engine->clamped;
+    struct scroll_engine_sample sample;
 
-    /* Steps are integer part of accumulated steps over the internal multiplier */
-    int32_t steps = SCROLLER_CONFIG.scroll_accumulator / SCROLLER_CONFIG.internal_divider;
-    SCROLLER_CONFIG.scroll_accumulator %= SCROLLER_CONFIG.internal_divider;
+    axis_samples[axis]++;
 
-    /* Release the global config */
-    k_mutex_unlock(&scroller_config_mutex);
+    uint32_t dt_us = sample_interval_us(axis);
+    /* Magnet misalignment correction, applied by the engine. The trace keeps the raw position */
+    engine->linearize = calibration_process(axis, sensor_steps);
 
-    /* Move cur to prev*/
-    prev_steps = curr_steps;
+    int16_t steps = scroll_engine_process(engine, sensor_steps, dt_us, divider, &sample);
+    int16_t delta = sample.delta;
 
-    if (steps > INT16_MAX)
+    if (engine->clamped != clamped)
     {
-        LOG_WRN("Steps overflowing 16bits, truncating: %d", steps);
-        return INT16_MAX;
+        LOG_WRN("Steps overflowing 16bits, truncating: %u", engine->clamped - clamped);
     }
-    else if (steps < INT16_MIN)
+
+    if (steps)
     {
-        LOG_WRN("Steps overflowing 16bits, truncating: %d", steps);
-        return INT16_MIN;
+        latency_mark(LATENCY_STAGE_CALCULATE);
     }
-    else
+
+#ifdef CONFIG_SCROLLER_KINETIC
+    /* Track the velocity, or start coasting once a flick is released. Vertical wheel only */
+    if (axis == SCROLL_AXIS_WHEEL)
     {
-        return (int16_t)steps;
+        kinetic_sample(delta, steps, dt_us);
     }
+#endif
+
+    /* Merge into the steps waiting for the sender, never drops */
+    step_accumulator_put(axis, steps);
+
+    /* Raw angle capture, encoded in place and sent from the UART interrupt */
+    trace_record(axis, sensor_steps, steps);
+
+#ifdef CONFIG_SCROLLER_SAMPLE_STATS
+    sample_stats.samples++;
+#endif
+
+    profile_end(PROFILE_SECTION_CALCULATE, profile_start);
+
+    return delta;
+}
+
+void scroll_resync(enum scroll_axis axis)
+{
+    engines[axis].has_prev = false;
 }
 
+#ifdef CONFIG_CAF_SENSOR_EVENTS
 /* Process sensor event */
 void process_sensor_event(struct sensor_event *event)
 {
-    int err;
+    /* The sensor event carries no fetch time, so on this path the mark is taken at dispatch.
+     * Allocation and the event manager queue fall before it, outside the measured latency.
+     */
+    latency_mark(LATENCY_STAGE_FETCH);
+    profile_reads(1);
 
     if (event->dyndata.size != 8)
     {
@@ -93,25 +197,38 @@ void process_sensor_event(struct sensor_event *event)
     /* memcpy to avoid alignment/aliasing issues and take ownership incase the event is consumed before being sent */
     memcpy(&position, event->dyndata.data, event->dyndata.size);
 
-    int16_t steps = calculate_scroll(position.val1);
+    /* Both wheels share the sensor manager, the description tells them apart */
+    enum scroll_axis axis = strcmp(event->descr, SCROLLER_PAN_SENSOR_DESCR) ? SCROLL_AXIS_WHEEL : SCROLL_AXIS_PAN;
 
-    /* Avoid filling the queue with no change */
-    if (steps == 0)
-    {
-        return;
-    }
-
-    // FIXME: Race condition on the msg queue.
-    err = k_msgq_put(&step_msgq, &steps, K_NO_WAIT);
-    if (err < 0)
-    {
-        LOG_WRN("Failed to put queue: %d, %d, %d", err, k_msgq_num_used_get(&step_msgq), steps);
-    }
+    scroll_process_position(axis, position.val1);
 }
+#endif
 
-/* No initialization needed */
+/* Reset the scroll engines */
 int init()
 {
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        scroll_engine_init(&engines[axis]);
+#ifndef CONFIG_SCROLLER_ACCEL_NONE
+        engines[axis].accel = &accel_curve;
+#endif
+        engines[axis].filter.deadband = CONFIG_SCROLLER_FILTER_DEADBAND;
+#ifdef CONFIG_SCROLLER_PREDICT
+        engines[axis].predict = (struct scroll_predict){
+            .lead_us = CONFIG_SCROLLER_PREDICT_LEAD_US,
+            .alpha_q8 = CONFIG_SCROLLER_PREDICT_ALPHA_Q8,
+            .beta_q8 = CONFIG_SCROLLER_PREDICT_BETA_Q8,
+            .max_lead = CONFIG_SCROLLER_PREDICT_MAX_LEAD,
+        };
+#endif
+        prev_sample_cycles[axis] = k_cycle_get_32();
+    }
+
+#ifndef CONFIG_SCROLLER_ACCEL_NONE
+    LOG_INF("Acceleration profile: %s", SCROLLER_ACCEL_LUT_PROFILE);
+#endif
+
     return 0;
 }
 
@@ -138,10 +255,65 @@ void process_module_state_event(struct module_state_event *event)
     }
 }
 
+/* Process power down event */
+void process_power_down_event(struct power_down_event *event)
+{
+    struct step_accumulator_stats stats;
+
+    step_accumulator_stats_get(&stats);
+    LOG_INF("Steps coalesced: %u, clamped: %u", stats.coalesced, stats.clamped);
+
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        const struct scroll_filter *filter = &engines[axis].filter;
+
+        if (axis == SCROLL_AXIS_PAN && !SCROLLER_HAS_PAN)
+        {
+            continue;
+        }
+
+#ifdef CONFIG_SCROLLER_PREDICT
+        const struct scroll_predict *predict = &engines[axis].predict;
+
+        LOG_INF("Axis %d prediction %u us: predicted samples: %u, lead: %d, peak lead: %d counts", axis,
+                predict->lead_us, predict->predicted, predict->lead, predict->lead_peak);
+#endif
+
+        if (!filter->deadband)
+        {
+            continue;
+        }
+
+        LOG_INF("Axis %d filter deadband %d: suppressed: %u, delayed: %u, added latency (us) avg: %u, max: %u",
+                axis, filter->deadband, filter->suppressed, filter->delayed,
+                filter->delayed ? (uint32_t)(filter->latency_total_us / filter->delayed) : 0,
+                filter->latency_max_us);
+    }
+
+#ifdef CONFIG_SCROLLER_KINETIC
+    struct kinetic_stats kinetic;
+
+    /* No coasting while the device sleeps */
+    kinetic_stop();
+    kinetic_stats_get(&kinetic);
+    LOG_INF("Kinetic coasts: %u, cancelled: %u, steps: %u, max tick: %u ns",
+            kinetic.coasts, kinetic.cancelled, kinetic.steps, kinetic.max_tick_ns);
+#endif
+
+#ifdef CONFIG_SCROLLER_SAMPLE_STATS
+    log_sample_stats();
+#endif
+}
+
 /* Process wake up event */
 void process_wake_up_event(struct wake_up_event *event)
 {
     LOG_WRN("Wakeup");
+
+#ifdef CONFIG_SCROLLER_SAMPLE_STATS
+    sample_stats.samples = 0;
+    sample_stats.start_cycles = busy_cycles();
+#endif
 }
 
 /* Event handler for incoming events */
@@ -152,11 +324,18 @@ static bool app_event_handler(const struct app_event_header *aeh)
         struct module_state_event *event = cast_module_state_event(aeh);
         process_module_state_event(event);
     }
+#ifdef CONFIG_CAF_SENSOR_EVENTS
     else if (is_sensor_event(aeh))
     {
         struct sensor_event *event = cast_sensor_event(aeh);
         process_sensor_event(event);
     }
+#endif
+    else if (is_power_down_event(aeh))
+    {
+        struct power_down_event *event = cast_power_down_event(aeh);
+        process_power_down_event(event);
+    }
     else if (is_wake_up_event(aeh))
     {
         struct wake_up_event *event = cast_wake_up_event(aeh);
@@ -169,8 +348,10 @@ static bool app_event_handler(const struct app_event_header *aeh)
 APP_EVENT_LISTENER(MODULE, app_event_handler);
 /* Listen for modules changing state */
 APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
+#ifdef CONFIG_CAF_SENSOR_EVENTS
 /* Listen for sensor events */
 APP_EVENT_SUBSCRIBE(MODULE, sensor_event);
+#endif
 /* Listen for power events */
 APP_EVENT_SUBSCRIBE(MODULE, power_down_event);
 APP_EVENT_SUBSCRIBE(MODULE, wake_up_event);
\ No newline at end of file
@@ -1,6 +1,27 @@
 #ifndef SCROLLER_SCROLL_CALCULATE_H
 #define SCROLLER_SCROLL_CALCULATE_H
 
-extern struct k_msgq step_msgq;
+#include <stdint.h>
+
+#include "scroller_config.h"
+
+/* Scroll calculation counters, per axis */
+struct scroll_stats
+{
+    uint32_t samples[SCROLL_AXIS_COUNT];
+    /* Samples whose change the rest filter held back */
+    uint32_t suppressed[SCROLL_AXIS_COUNT];
+    /* Steps truncated to fit int16 */
+    uint32_t clamped[SCROLL_AXIS_COUNT];
+};
+
+/* Read the scroll calculation counters */
+void scroll_stats_get(struct scroll_stats *stats);
+
+/* Convert a raw position and hand the steps to the sender, returns the unscaled position change */
+int16_t scroll_process_position(enum scroll_axis axis, int32_t sensor_steps);
+
+/* Drop the reference position of an axis, the next position only sets it again */
+void scroll_resync(enum scroll_axis axis);
 
 #endif
\ No newline at end of file
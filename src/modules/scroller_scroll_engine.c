@@ -0,0 +1,273 @@
+#include "scroller_scroll_engine.h"
+
+#include <stddef.h>
+
+#include "scroller_linearize.h"
+
+void scroll_engine_init(struct scroll_engine *engine)
+{
+    *engine = (struct scroll_engine){
+        .linearize = NULL,
+        .prev_position = 0,
+        .has_prev = false,
+        .filter = {0},
+        .accel = NULL,
+        .accel_remainder = 0,
+        .predict = {0},
+        .accumulator = 0,
+        .clamped = 0,
+    };
+}
+
+int16_t scroll_engine_delta(struct scroll_engine *engine, int32_t position)
+{
+    int16_t curr_position = (position & 0xFFFF);
+
+    /* Without a reference the first position would read as a jump from zero */
+    if (!engine->has_prev)
+    {
+        engine->prev_position = curr_position;
+        engine->has_prev = true;
+        return 0;
+    }
+
+    int16_t delta = engine->prev_position - curr_position;
+
+    if (!delta)
+    {
+        return 0;
+    }
+
+    /* Handle wrapping the zero point */
+    if (delta > SCROLL_ENGINE_COUNTS / 2)
+    {
+        delta -= SCROLL_ENGINE_COUNTS; /* Negative direction wrap */
+    }
+    else if (delta < -SCROLL_ENGINE_COUNTS / 2)
+    {
+        delta += SCROLL_ENGINE_COUNTS; /* Positive direction wrap */
+    }
+
+    /* Invert scroll direction */
+    delta *= -1;
+
+    /* Move cur to prev*/
+    engine->prev_position = curr_position;
+
+    return delta;
+}
+
+int16_t scroll_engine_filter(struct scroll_engine *engine, int16_t delta, uint32_t dt_us)
+{
+    struct scroll_filter *filter = &engine->filter;
+    int32_t prev_residual = filter->residual;
+
+    if (filter->deadband <= 0 || (!delta && !prev_residual))
+    {
+        return delta;
+    }
+
+    filter->residual += delta;
+
+    int32_t magnitude = filter->residual < 0 ? -filter->residual : filter->residual;
+    int8_t direction = filter->residual < 0 ? -1 : 1;
+
+    /* Back at the held position, or reversing within the deadband */
+    if (!filter->residual || (direction != filter->direction && magnitude <= filter->deadband))
+    {
+        /* Held time counts from the first sample held */
+        filter->held_us = (filter->residual && prev_residual) ? filter->held_us + dt_us : 0;
+        filter->suppressed += delta ? 1 : 0;
+        return 0;
+    }
+
+    /* Let the change through, with anything held back since the last one */
+    if (prev_residual)
+    {
+        uint32_t latency_us = filter->held_us + dt_us;
+
+        filter->delayed++;
+        filter->latency_total_us += latency_us;
+        filter->latency_max_us = latency_us > filter->latency_max_us ? latency_us : filter->latency_max_us;
+    }
+
+    delta = (int16_t)filter->residual;
+    filter->residual = 0;
+    filter->held_us = 0;
+    filter->direction = direction;
+
+    return delta;
+}
+
+/* Interpolated Q8 gain for a velocity in counts per 100 ms */
+static int32_t accel_gain(const struct scroll_accel_curve *curve, uint32_t velocity)
+{
+    uint32_t index = velocity / curve->velocity_step;
+
+    if (index >= curve->count - 1U)
+    {
+        return curve->gain_q8[curve->count - 1];
+    }
+
+    int32_t low = curve->gain_q8[index];
+    int32_t high = curve->gain_q8[index + 1];
+    int32_t frac = velocity % curve->velocity_step;
+
+    return low + (high - low) * frac / curve->velocity_step;
+}
+
+int32_t scroll_engine_accelerate(struct scroll_engine *engine, int16_t delta, uint32_t dt_us)
+{
+    if (!engine->accel || !delta)
+    {
+        return delta;
+    }
+
+    uint32_t magnitude = delta < 0 ? -delta : delta;
+    uint32_t velocity = magnitude * 100000U / (dt_us ? dt_us : 1U);
+
+    /* Scale in Q8 and keep the fraction for the next change */
+    int32_t scaled = delta * accel_gain(engine->accel, velocity) + engine->accel_remainder;
+    int32_t accelerated = scaled / 256;
+
+    engine->accel_remainder = scaled - accelerated * 256;
+
+    return accelerated;
+}
+
+/* Gap after which the velocity estimate is stale and starts over */
+#define PREDICT_RESET_US 100000
+
+int32_t scroll_engine_predict(struct scroll_engine *engine, int32_t delta, uint32_t dt_us)
+{
+    struct scroll_predict *predict = &engine->predict;
+
+    if (!predict->lead_us)
+    {
+        return delta;
+    }
+
+    if (!dt_us || dt_us > PREDICT_RESET_US)
+    {
+        predict->error_q8 = 0;
+        predict->velocity_q16 = 0;
+    }
+    else
+    {
+        /* Residual of the measured position against the estimate moved on by dt */
+        int64_t step_q8 = ((int64_t)predict->velocity_q16 * dt_us) >> 8;
+        int32_t residual_q8 = (int32_t)(((int64_t)delta << 8) - predict->error_q8 - step_q8);
+
+        predict->error_q8 = -(int32_t)(((int64_t)(256 - predict->alpha_q8) * residual_q8) >> 8);
+        predict->velocity_q16 += (int32_t)((int64_t)predict->beta_q8 * residual_q8 / dt_us);
+    }
+
+    /* Change the wheel is expected to make before the host collects it */
+    int32_t target = (int32_t)(((int64_t)predict->velocity_q16 * predict->lead_us) >> 16);
+
+    if (target > predict->max_lead)
+    {
+        target = predict->max_lead;
+    }
+    else if (target < -predict->max_lead)
+    {
+        target = -predict->max_lead;
+    }
+
+    int32_t correction = target - predict->lead;
+
+    /* The lead moves at most as fast as the wheel turns. A lead left ahead by a hard stop is
+     * paid back by a reversal gradually instead of in one jump of up to max_lead
+     */
+    int32_t bound = delta < 0 ? -delta : delta;
+
+    if (correction > bound)
+    {
+        correction = bound;
+    }
+    else if (correction < -bound)
+    {
+        correction = -bound;
+    }
+
+    /* Move the lead towards the target, never against the measured change */
+    int32_t out = delta + correction;
+
+    if ((delta > 0 && out < 0) || (delta < 0 && out > 0) || !delta)
+    {
+        out = 0;
+    }
+
+    predict->lead += out - delta;
+
+    int32_t lead_magnitude = predict->lead < 0 ? -predict->lead : predict->lead;
+
+    if ((delta > 0 && out > delta) || (delta < 0 && out < delta))
+    {
+        predict->predicted++;
+    }
+    if (lead_magnitude > predict->lead_peak)
+    {
+        predict->lead_peak = lead_magnitude;
+    }
+
+    return out;
+}
+
+int16_t scroll_engine_scale(struct scroll_engine *engine, int32_t delta, int32_t divider)
+{
+    if (!delta)
+    {
+        return 0;
+    }
+
+    engine->accumulator += delta;
+
+    /*
+     * Apply an internal scroll accumulator. The linux kernel only supports down to
+     * (int)(steps * 120 / RES MULT) resulting a maximum of 120 steps per detent. Fractional
+     * scrolling is not supported. The sensor emits 4096/120 ~34 detents per revolution
+     * which is high.
+     */
+
+    /* Steps are integer part of accumulated steps over the internal multiplier */
+    int32_t steps = engine->accumulator / divider;
+    engine->accumulator %= divider;
+
+    if (steps > INT16_MAX)
+    {
+        engine->clamped += steps - INT16_MAX;
+        return INT16_MAX;
+    }
+    else if (steps < INT16_MIN)
+    {
+        engine->clamped += INT16_MIN - steps;
+        return INT16_MIN;
+    }
+    else
+    {
+        return (int16_t)steps;
+    }
+}
+
+int16_t scroll_engine_process(struct scroll_engine *engine, int32_t position, uint32_t dt_us, int32_t divider,
+                              struct scroll_engine_sample *sample)
+{
+    /* Misalignment correction before the wrap handling */
+    if (engine->linearize)
+    {
+        position = linearize_apply(engine->linearize, position);
+    }
+
+    int16_t raw = scroll_engine_delta(engine, position);
+    int16_t delta = scroll_engine_filter(engine, raw, dt_us);
+    int32_t accelerated = scroll_engine_accelerate(engine, delta, dt_us);
+
+    if (sample)
+    {
+        sample->raw = raw;
+        sample->delta = delta;
+    }
+
+    return scroll_engine_scale(engine, scroll_engine_predict(engine, accelerated, dt_us), divider);
+}
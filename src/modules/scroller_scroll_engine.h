@@ -0,0 +1,185 @@
+#ifndef SCROLLER_SCROLL_ENGINE_H
+#define SCROLLER_SCROLL_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Sensor counts per revolution */
+#define SCROLL_ENGINE_COUNTS 4096
+
+/* Acceleration gain curve, Q8 gains at evenly spaced velocities. Velocities past the
+ * last entry use the last gain.
+ */
+struct scroll_accel_curve
+{
+    const uint16_t *gain_q8;
+    uint16_t count;
+    /* Velocity between entries, in counts per 100 ms */
+    uint16_t velocity_step;
+};
+
+/* Rest jitter filter state and statistics */
+struct scroll_filter
+{
+    /* Reversal deadband in counts, 0 disables the filter */
+    int32_t deadband;
+    /* Position change held back by the deadband */
+    int32_t residual;
+    /* Direction of the last change let through, 0 before any */
+    int8_t direction;
+    /* Time the current residual has been held */
+    uint32_t held_us;
+    /* Samples with a position change that produced none */
+    uint32_t suppressed;
+    /* Held changes later let through, and the latency they gained */
+    uint32_t delayed;
+    uint64_t latency_total_us;
+    uint32_t latency_max_us;
+};
+
+/* Latency compensation, an alpha-beta velocity estimator extrapolating the position
+ * change to the time the host collects it
+ */
+struct scroll_predict
+{
+    /* Extrapolation time, 0 disables prediction */
+    uint32_t lead_us;
+    /* Q8 position and velocity gains of the estimator */
+    int32_t alpha_q8;
+    int32_t beta_q8;
+    /* Largest position change emitted ahead of the wheel, in accelerated counts */
+    int32_t max_lead;
+    /* Estimated minus measured position, Q8 counts */
+    int32_t error_q8;
+    /* Estimated velocity, Q16 counts per us */
+    int32_t velocity_q16;
+    /* Position change emitted ahead of the wheel, paid back by the following motion */
+    int32_t lead;
+    /* Samples emitting ahead of the wheel, and the largest lead reached */
+    uint32_t predicted;
+    int32_t lead_peak;
+};
+
+struct linearize_table;
+
+/* Position changes of one sample through scroll_engine_process() */
+struct scroll_engine_sample
+{
+    /* Wrap corrected change, before the rest filter */
+    int16_t raw;
+    /* Change after the rest filter, before acceleration */
+    int16_t delta;
+};
+
+/* Scroll engine state. Holds no kernel objects so it can be instantiated anywhere,
+ * including host builds.
+ */
+struct scroll_engine
+{
+    /* Magnet misalignment correction, NULL for none */
+    const struct linearize_table *linearize;
+    /* Last sensor position */
+    int16_t prev_position;
+    /* The first position only sets the reference */
+    bool has_prev;
+    /* Rest jitter filter */
+    struct scroll_filter filter;
+    /* Acceleration curve, NULL for none */
+    const struct scroll_accel_curve *accel;
+    /* Q8 fraction of a count left over from acceleration */
+    int32_t accel_remainder;
+    /* Latency compensation */
+    struct scroll_predict predict;
+    /* Position change not yet emitted as whole steps */
+    int32_t accumulator;
+    /* Steps truncated to fit int16 */
+    uint32_t clamped;
+};
+
+/**
+ * @brief Reset the engine state.
+ *
+ * @param engine Engine to reset
+ */
+void scroll_engine_init(struct scroll_engine *engine);
+
+/**
+ * @brief Convert a raw position to a wrap corrected and direction inverted position change.
+ *
+ * @param engine   Engine state
+ * @param position Raw sensor position, 0 to SCROLL_ENGINE_COUNTS - 1
+ * @return Position change since the previous position
+ */
+int16_t scroll_engine_delta(struct scroll_engine *engine, int32_t position);
+
+/**
+ * @brief Remove rest jitter from a position change.
+ *
+ * Changes continuing in the direction of the last change pass straight through, so
+ * motion gains no lag. Starting in the other direction the change has to exceed the
+ * deadband before it passes, in full. A wheel jittering at rest is held there.
+ *
+ * @param engine Engine state
+ * @param delta  Position change
+ * @param dt_us  Time since the previous position
+ * @return Filtered position change
+ */
+int16_t scroll_engine_filter(struct scroll_engine *engine, int16_t delta, uint32_t dt_us);
+
+/**
+ * @brief Apply the velocity dependent acceleration gain to a position change.
+ *
+ * The fractional part of the scaled change is carried to the next call, so no distance
+ * is lost to rounding. Without a curve the change is returned as is.
+ *
+ * @param engine Engine state
+ * @param delta  Position change
+ * @param dt_us  Time since the previous position
+ * @return Accelerated position change
+ */
+int32_t scroll_engine_accelerate(struct scroll_engine *engine, int16_t delta, uint32_t dt_us);
+
+/**
+ * @brief Extrapolate a position change to the expected transmit time.
+ *
+ * Tracks the velocity with an alpha-beta filter and emits the change the wheel is
+ * expected to make over the lead time on top of the measured change. Whatever was
+ * emitted ahead is carried and taken back out of the following changes, so the total
+ * distance stays exact. The output never moves against the measured change, a wheel
+ * stopping after a prediction holds the lead until it moves again. Without a lead time
+ * the change is returned as is.
+ *
+ * @param engine Engine state
+ * @param delta  Position change
+ * @param dt_us  Time since the previous position
+ * @return Position change to emit
+ */
+int32_t scroll_engine_predict(struct scroll_engine *engine, int32_t delta, uint32_t dt_us);
+
+/**
+ * @brief Accumulate a position change and emit the whole steps.
+ *
+ * @param engine  Engine state
+ * @param delta   Position change
+ * @param divider Position change per emitted step
+ * @return Steps, clamped to the int16 range
+ */
+int16_t scroll_engine_scale(struct scroll_engine *engine, int32_t delta, int32_t divider);
+
+/**
+ * @brief Run a raw position through every stage to steps.
+ *
+ * Linearize, delta, filter, accelerate, predict and scale, in that order. The one pipeline
+ * of the firmware and the replay.
+ *
+ * @param engine   Engine state
+ * @param position Raw sensor position, 0 to SCROLL_ENGINE_COUNTS - 1
+ * @param dt_us    Time since the previous position
+ * @param divider  Position change per emitted step
+ * @param sample   Output for the position changes of the sample, may be NULL
+ * @return Steps, clamped to the int16 range
+ */
+int16_t scroll_engine_process(struct scroll_engine *engine, int32_t position, uint32_t dt_us, int32_t divider,
+                              struct scroll_engine_sample *sample);
+
+#endif /* SCROLLER_SCROLL_ENGINE_H */
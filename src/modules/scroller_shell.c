@@ -0,0 +1,402 @@
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scroller_config.h"
+#include "scroller_scroll_calculate.h"
+#include "scroller_step_accumulator.h"
+#include "scroller_usb.h"
+#ifdef CONFIG_SCROLLER_ACQUIRE_RTIO
+#include "scroller_acquire.h"
+#endif
+#ifdef CONFIG_SCROLLER_TRACE
+#include "scroller_trace.h"
+#endif
+#ifdef CONFIG_SCROLLER_CALIBRATION
+#include "scroller_calibration.h"
+#endif
+#ifdef CONFIG_SCROLLER_PROFILE
+#include "scroller_profile.h"
+#endif
+
+/* Copy of the current tuning, edited by a command and published back */
+static void tuning_get(struct scroller_tuning_t *tuning)
+{
+    struct scroller_config_t config;
+
+    scroller_config_get(&config);
+    *tuning = config.tuning;
+}
+
+static int parse_long(const struct shell *sh, const char *arg, long min, long max, long *value)
+{
+    int err = 0;
+
+    *value = shell_strtol(arg, 10, &err);
+    if (err || *value < min || *value > max)
+    {
+        shell_error(sh, "Expected a value from %ld to %ld: %s", min, max, arg);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int cmd_show(const struct shell *sh, size_t argc, char **argv)
+{
+    struct scroller_config_t config;
+
+    scroller_config_get(&config);
+
+    shell_print(sh, "Host resolution: %s, divider in use: %d", config.hi_res ? "high" : "low",
+                config.internal_divider);
+    shell_print(sh, "divider:  low %d, high %d", config.tuning.low_res_divider, config.tuning.hi_res_divider);
+    shell_print(sh, "period:   %u ms%s", config.tuning.sample_period_ms,
+                IS_ENABLED(CONFIG_SCROLLER_ACQUIRE_RTIO) ? "" : " (RTIO acquisition only)");
+    shell_print(sh, "deadband: %d counts", config.tuning.filter_deadband);
+    shell_print(sh, "accel:    %s", config.tuning.accel_enabled ? "on" : "off");
+
+    return 0;
+}
+
+static int cmd_divider(const struct shell *sh, size_t argc, char **argv)
+{
+    struct scroller_tuning_t tuning;
+    long low;
+    long high;
+
+    tuning_get(&tuning);
+    high = tuning.hi_res_divider;
+
+    if (parse_long(sh, argv[1], SCROLLER_TUNING_DIVIDER_MIN, SCROLLER_TUNING_DIVIDER_MAX, &low) ||
+        (argc > 2 && parse_long(sh, argv[2], SCROLLER_TUNING_DIVIDER_MIN, SCROLLER_TUNING_DIVIDER_MAX, &high)))
+    {
+        return -EINVAL;
+    }
+
+    tuning.low_res_divider = low;
+    tuning.hi_res_divider = high;
+    scroller_config_set_tuning(&tuning);
+
+    return 0;
+}
+
+static int cmd_period(const struct shell *sh, size_t argc, char **argv)
+{
+    struct scroller_tuning_t tuning;
+    long period;
+
+    if (parse_long(sh, argv[1], SCROLLER_TUNING_PERIOD_MIN_MS, SCROLLER_TUNING_PERIOD_MAX_MS, &period))
+    {
+        return -EINVAL;
+    }
+
+    if (!IS_ENABLED(CONFIG_SCROLLER_ACQUIRE_RTIO))
+    {
+        shell_warn(sh, "The sensor manager period is fixed, applies to RTIO acquisition only");
+    }
+
+    tuning_get(&tuning);
+    tuning.sample_period_ms = period;
+    scroller_config_set_tuning(&tuning);
+
+    return 0;
+}
+
+static int cmd_deadband(const struct shell *sh, size_t argc, char **argv)
+{
+    struct scroller_tuning_t tuning;
+    long deadband;
+
+    if (parse_long(sh, argv[1], 0, SCROLLER_TUNING_DEADBAND_MAX, &deadband))
+    {
+        return -EINVAL;
+    }
+
+    tuning_get(&tuning);
+    tuning.filter_deadband = deadband;
+    scroller_config_set_tuning(&tuning);
+
+    return 0;
+}
+
+static int cmd_accel(const struct shell *sh, size_t argc, char **argv)
+{
+    struct scroller_tuning_t tuning;
+    bool enable;
+
+    if (!strcmp(argv[1], "on"))
+    {
+        enable = true;
+    }
+    else if (!strcmp(argv[1], "off"))
+    {
+        enable = false;
+    }
+    else
+    {
+        shell_error(sh, "Expected on or off: %s", argv[1]);
+        return -EINVAL;
+    }
+
+    if (enable && IS_ENABLED(CONFIG_SCROLLER_ACCEL_NONE))
+    {
+        shell_error(sh, "No acceleration profile in this build");
+        return -ENOTSUP;
+    }
+
+    tuning_get(&tuning);
+    tuning.accel_enabled = enable;
+    scroller_config_set_tuning(&tuning);
+
+    return 0;
+}
+
+static int cmd_save(const struct shell *sh, size_t argc, char **argv)
+{
+    int err = scroller_config_save();
+
+    if (err)
+    {
+        shell_error(sh, "Save failed: %d", err);
+        return err;
+    }
+
+    shell_print(sh, "Saved");
+
+    return 0;
+}
+
+static int cmd_defaults(const struct shell *sh, size_t argc, char **argv)
+{
+    const struct scroller_tuning_t tuning = SCROLLER_TUNING_DEFAULTS;
+
+    scroller_config_set_tuning(&tuning);
+    shell_print(sh, "Defaults restored, save to persist");
+
+    return 0;
+}
+
+static int cmd_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    struct scroll_stats scroll;
+    struct step_accumulator_stats accumulator;
+    struct usb_report_stats usb;
+
+    scroll_stats_get(&scroll);
+    step_accumulator_stats_get(&accumulator);
+    usb_report_stats_get(&usb);
+
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        shell_print(sh, "axis %d:   samples %u, filtered %u, clamped %u", axis, scroll.samples[axis],
+                    scroll.suppressed[axis], scroll.clamped[axis]);
+    }
+    shell_print(sh, "queue:    coalesced %u, clamped %u, high water %u", accumulator.coalesced,
+                accumulator.clamped, accumulator.high_water);
+    shell_print(sh, "usb:      reports %u, dropped %u", usb.reports, usb.dropped);
+    if (usb.intervals)
+    {
+        shell_print(sh, "interval: min %u us, avg %u us, max %u us, late %u of %u", usb.interval_min_us,
+                    (uint32_t)(usb.interval_total_us / usb.intervals), usb.interval_max_us, usb.late,
+                    usb.intervals);
+    }
+
+#ifdef CONFIG_SCROLLER_ACQUIRE_RTIO
+    struct acquire_stats acquire;
+
+    acquire_stats_get(&acquire);
+    shell_print(sh, "i2c:      reads %u, errors %u, timeouts %u, overruns %u", acquire.samples, acquire.i2c_errors,
+                acquire.timeouts, acquire.overruns);
+    shell_print(sh, "recovery: retries %u, bus recoveries %u (%u failed), dropped %u, resyncs %u, worst stall %u us",
+                acquire.retries, acquire.recoveries, acquire.recovery_errors, acquire.dropped, acquire.resyncs,
+                acquire.max_stall_us);
+#else
+    shell_print(sh, "i2c:      errors are only counted by RTIO acquisition");
+#endif
+
+#ifdef CONFIG_SCROLLER_TRACE
+    struct trace_stats trace;
+
+    trace_stats_get(&trace);
+    shell_print(sh, "trace:    records %u, frames %u, dropped %u", trace.records, trace.frames, trace.dropped);
+#endif
+
+    return 0;
+}
+
+#ifdef CONFIG_SCHED_THREAD_USAGE
+/* Cycles of all threads, idle included, for the share of each thread */
+static uint64_t all_cycles;
+
+static void print_thread(const struct k_thread *cthread, void *user_data)
+{
+    const struct shell *sh = user_data;
+    struct k_thread *thread = (struct k_thread *)cthread;
+    k_thread_runtime_stats_t rt;
+    const char *name = k_thread_name_get(thread);
+
+    if (k_thread_runtime_stats_get(thread, &rt))
+    {
+        return;
+    }
+
+    /* Share in tenths of a percent */
+    uint32_t permille = all_cycles ? (uint32_t)(rt.execution_cycles * 1000 / all_cycles) : 0;
+
+    shell_print(sh, "%-16s prio %3d, cycles %llu, cpu %u.%u%%", name ? name : "?", k_thread_priority_get(thread),
+                (unsigned long long)rt.execution_cycles, permille / 10, permille % 10);
+
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+    size_t unused;
+
+    if (!k_thread_stack_space_get(thread, &unused))
+    {
+        shell_print(sh, "%-16s stack %zu, unused %zu", "", thread->stack_info.size, unused);
+    }
+#endif
+}
+
+static int cmd_threads(const struct shell *sh, size_t argc, char **argv)
+{
+    k_thread_runtime_stats_t all;
+
+    k_thread_runtime_stats_all_get(&all);
+    all_cycles = all.execution_cycles;
+    shell_print(sh, "all              cycles %llu", (unsigned long long)all.execution_cycles);
+    k_thread_foreach(print_thread, (void *)sh);
+
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_SCROLLER_PROFILE
+static int cmd_profile(const struct shell *sh, size_t argc, char **argv)
+{
+    static const char *const section_names[PROFILE_SECTION_COUNT] = {"calculate", "dispatch", "send"};
+    static const char *const state_names[PROFILE_STATE_COUNT] = {"active", "idle"};
+    struct profile_stats stats;
+
+    if (argc > 1)
+    {
+        if (strcmp(argv[1], "reset"))
+        {
+            shell_error(sh, "Expected reset: %s", argv[1]);
+            return -EINVAL;
+        }
+
+        profile_reset();
+        return 0;
+    }
+
+    profile_stats_get(&stats);
+
+    for (int i = 0; i < PROFILE_SECTION_COUNT; i++)
+    {
+        const struct profile_section_stats *section = &stats.sections[i];
+
+        shell_print(sh, "%-10s calls %u, avg %u ns, max %u ns", section_names[i], section->calls,
+                    section->calls ? (uint32_t)(section->total_ns / section->calls) : 0, section->max_ns);
+    }
+
+    for (int i = 0; i < PROFILE_STATE_COUNT; i++)
+    {
+        const struct profile_state_stats *account = &stats.states[i];
+
+        shell_print(sh, "%-10s %llu ms, cpu %llu us, twim %llu us, reads %u, reports %u, energy %llu uJ",
+                    state_names[i], (unsigned long long)(account->time_us / USEC_PER_MSEC),
+                    (unsigned long long)account->cpu_us, (unsigned long long)account->twim_us, account->reads,
+                    account->reports, (unsigned long long)(account->energy_nj / 1000));
+    }
+
+    shell_print(sh, "energy:    %u nJ per report, %u nJ per idle second", stats.report_energy_nj,
+                stats.idle_second_energy_nj);
+
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_SCROLLER_CALIBRATION
+static int cmd_calib_start(const struct shell *sh, size_t argc, char **argv)
+{
+    long axis;
+    long revolutions = CONFIG_SCROLLER_CALIBRATION_REVOLUTIONS;
+
+    if (parse_long(sh, argv[1], 0, SCROLL_AXIS_COUNT - 1, &axis) ||
+        (argc > 2 && parse_long(sh, argv[2], 2, 16, &revolutions)))
+    {
+        return -EINVAL;
+    }
+
+    if (calibration_start(axis, revolutions))
+    {
+        shell_error(sh, "A calibration is already running");
+        return -EBUSY;
+    }
+
+    shell_print(sh, "Spin axis %ld slowly and steadily for %ld revolutions", axis, revolutions);
+
+    return 0;
+}
+
+static int cmd_calib_clear(const struct shell *sh, size_t argc, char **argv)
+{
+    long axis;
+
+    if (parse_long(sh, argv[1], 0, SCROLL_AXIS_COUNT - 1, &axis))
+    {
+        return -EINVAL;
+    }
+
+    calibration_clear(axis);
+
+    return 0;
+}
+
+static int cmd_calib_show(const struct shell *sh, size_t argc, char **argv)
+{
+    struct calibration_status status;
+
+    calibration_status_get(&status);
+
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        shell_print(sh, "axis %d:   %s, peak %d counts, last result %d%s", axis,
+                    status.valid[axis] ? "calibrated" : "uncalibrated", status.peak[axis], status.result[axis],
+                    status.recording == axis ? ", recording" : "");
+    }
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    calib_cmds,
+    SHELL_CMD_ARG(start, NULL, "Record a correction table: <axis> [revolutions]", cmd_calib_start, 2, 1),
+    SHELL_CMD_ARG(clear, NULL, "Remove the correction table: <axis>", cmd_calib_clear, 2, 0),
+    SHELL_CMD(show, NULL, "Show the calibration state", cmd_calib_show),
+    SHELL_SUBCMD_SET_END);
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    scroller_cmds,
+    SHELL_CMD(show, NULL, "Show the current settings", cmd_show),
+    SHELL_CMD_ARG(divider, NULL, "Steps divider: <low res> [high res]", cmd_divider, 2, 1),
+    SHELL_CMD_ARG(period, NULL, "Sampling period: <ms>", cmd_period, 2, 0),
+    SHELL_CMD_ARG(deadband, NULL, "Rest jitter deadband: <counts>, 0 disables", cmd_deadband, 2, 0),
+    SHELL_CMD_ARG(accel, NULL, "Acceleration: <on|off>", cmd_accel, 2, 0),
+    SHELL_CMD(save, NULL, "Persist the current settings", cmd_save),
+    SHELL_CMD(defaults, NULL, "Restore the default settings", cmd_defaults),
+    SHELL_CMD(stats, NULL, "Dump the counters", cmd_stats),
+#ifdef CONFIG_SCHED_THREAD_USAGE
+    SHELL_CMD(threads, NULL, "Thread runtime statistics", cmd_threads),
+#endif
+#ifdef CONFIG_SCROLLER_PROFILE
+    SHELL_CMD_ARG(profile, NULL, "Section cycles and estimated energy: [reset]", cmd_profile, 1, 1),
+#endif
+#ifdef CONFIG_SCROLLER_CALIBRATION
+    SHELL_CMD(calib, &calib_cmds, "Magnet misalignment calibration", NULL),
+#endif
+    SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(scroller, &scroller_cmds, "Scroller tuning and telemetry", NULL);
@@ -0,0 +1,149 @@
+#include "scroller_step_accumulator.h"
+
+#include <zephyr/sys/atomic.h>
+
+/* Steps produced but not yet sent, per axis. Only ever added to by the producers and
+ * swapped out by the consumer, so no steps are lost if the sender is busy.
+ */
+static atomic_t pending_steps[SCROLL_AXIS_COUNT];
+/* Cycle count of the oldest pending step, set by a producer when nothing is pending */
+static atomic_t pending_since = ATOMIC_INIT(0);
+
+/* Counters for checking the coalescing behaviour under load */
+static atomic_t coalesced_count = ATOMIC_INIT(0);
+static atomic_t clamped_count = ATOMIC_INIT(0);
+static atomic_t high_water = ATOMIC_INIT(0);
+/* Remainder carried over by the last get per axis, consumer only. Counted as clamped once */
+static atomic_val_t carried_steps[SCROLL_AXIS_COUNT];
+
+/* Signals the consumer that steps are pending. Binary, repeated puts coalesce into one wake */
+static K_SEM_DEFINE(steps_ready_sem, 0, 1);
+
+static bool nothing_pending(void)
+{
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        if (atomic_get(&pending_steps[axis]) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void step_accumulator_put(enum scroll_axis axis, int32_t steps)
+{
+    if (steps == 0)
+    {
+        return;
+    }
+
+    /* Stamp before adding. Only exact with a single producer: another producer, or a drain
+     * between the check and the add, can leave a stale stamp. It only feeds the latency
+     * statistics.
+     */
+    if (nothing_pending())
+    {
+        atomic_set(&pending_since, (atomic_val_t)k_cycle_get_32());
+    }
+
+    /* Merge into any steps the sender hasn't collected yet */
+    atomic_val_t before = atomic_add(&pending_steps[axis], steps);
+
+    if (before != 0)
+    {
+        atomic_inc(&coalesced_count);
+    }
+
+    /* Racy between producers, only a statistic */
+    atomic_val_t total = before + steps;
+    atomic_val_t magnitude = total < 0 ? -total : total;
+
+    if (magnitude > atomic_get(&high_water))
+    {
+        atomic_set(&high_water, magnitude);
+    }
+
+    k_sem_give(&steps_ready_sem);
+}
+
+int step_accumulator_get(int16_t steps[SCROLL_AXIS_COUNT], uint32_t *sample_cycles, k_timeout_t timeout)
+{
+    int err;
+    bool any = false;
+    bool carried = false;
+
+    err = k_sem_take(&steps_ready_sem, timeout);
+    if (err)
+    {
+        return -EAGAIN;
+    }
+
+    /* Read the stamp first, it can only be replaced once the pending steps are cleared */
+    uint32_t since = (uint32_t)atomic_get(&pending_since);
+
+    for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+    {
+        /* Take everything pending in one go */
+        atomic_val_t pending = atomic_clear(&pending_steps[axis]);
+        atomic_val_t remainder = 0;
+
+        if (pending > INT16_MAX)
+        {
+            remainder = pending - INT16_MAX;
+            pending = INT16_MAX;
+        }
+        else if (pending < INT16_MIN)
+        {
+            remainder = pending - INT16_MIN;
+            pending = INT16_MIN;
+        }
+
+        /* Only the excess beyond what was already carried in the same direction is new */
+        atomic_val_t excess = remainder;
+
+        if ((remainder > 0 && carried_steps[axis] > 0) || (remainder < 0 && carried_steps[axis] < 0))
+        {
+            excess = remainder > 0 ? MAX(remainder - carried_steps[axis], 0) : MIN(remainder - carried_steps[axis], 0);
+        }
+        carried_steps[axis] = remainder;
+
+        /* Carry the clamped remainder over to the next report, keeping its stamp */
+        if (remainder)
+        {
+            atomic_add(&clamped_count, excess > 0 ? excess : -excess);
+            atomic_set(&pending_since, (atomic_val_t)since);
+            atomic_add(&pending_steps[axis], remainder);
+            carried = true;
+        }
+
+        steps[axis] = (int16_t)pending;
+        any |= (pending != 0);
+    }
+
+    if (carried)
+    {
+        k_sem_give(&steps_ready_sem);
+    }
+
+    /* Opposing motion can cancel out between two gets */
+    if (!any)
+    {
+        return -EAGAIN;
+    }
+
+    if (sample_cycles)
+    {
+        *sample_cycles = since;
+    }
+
+    return 0;
+}
+
+void step_accumulator_stats_get(struct step_accumulator_stats *stats)
+{
+    stats->coalesced = (uint32_t)atomic_get(&coalesced_count);
+    stats->clamped = (uint32_t)atomic_get(&clamped_count);
+    stats->high_water = (uint32_t)atomic_get(&high_water);
+}
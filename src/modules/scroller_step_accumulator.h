@@ -0,0 +1,51 @@
+#ifndef SCROLLER_STEP_ACCUMULATOR_H
+#define SCROLLER_STEP_ACCUMULATOR_H
+
+#include <zephyr/kernel.h>
+
+#include "scroller_config.h"
+
+/* Step accumulator statistics */
+struct step_accumulator_stats
+{
+    /* Puts merged into steps that were still pending */
+    uint32_t coalesced;
+    /* Steps carried over to a later report due to int16 clamping */
+    uint32_t clamped;
+    /* Largest pending total on any axis */
+    uint32_t high_water;
+};
+
+/**
+ * @brief Add steps to the pending total of an axis. Never blocks and never drops.
+ *
+ * Safe from several producers, the scroll calculation of each axis and the kinetic tick.
+ * The stamp of the oldest pending step is only exact with a single producer.
+ *
+ * @param axis  Axis the steps were made on
+ * @param steps Steps to add
+ */
+void step_accumulator_put(enum scroll_axis axis, int32_t steps);
+
+/**
+ * @brief Take all pending steps of every axis as a single report.
+ *
+ * Single consumer: only called from the active sender. Totals outside of the int16 range
+ * are clamped and the remainder is left pending for the next call.
+ *
+ * @param steps         Output for the drained steps, one per axis
+ * @param sample_cycles Output for the cycle count the oldest drained step was put at, may be NULL
+ * @param timeout       Time to wait for steps to become available
+ * @return 0 on success, -EAGAIN if nothing was pending before the timeout or the pending
+ *         steps cancelled out on every axis
+ */
+int step_accumulator_get(int16_t steps[SCROLL_AXIS_COUNT], uint32_t *sample_cycles, k_timeout_t timeout);
+
+/**
+ * @brief Read the accumulator statistics.
+ *
+ * @param stats Output for the statistics
+ */
+void step_accumulator_stats_get(struct step_accumulator_stats *stats);
+
+#endif /* SCROLLER_STEP_ACCUMULATOR_H */
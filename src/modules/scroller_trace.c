@@ -0,0 +1,269 @@
+#define MODULE scroller_trace
+#include <caf/events/module_state_event.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_DBG);
+
+#include "scroller_trace.h"
+#include "scroller_scroll_engine.h"
+#include <caf/events/power_event.h>
+
+/* Largest record, a 5 byte time varint and two 3 byte zigzag varints */
+#define TRACE_RECORD_MAX_SIZE 11
+#define TRACE_FRAME_PAYLOAD_SIZE (CONFIG_SCROLLER_TRACE_FRAME_SIZE - TRACE_FRAME_HEADER_SIZE)
+
+BUILD_ASSERT(TRACE_FRAME_PAYLOAD_SIZE >= TRACE_RECORD_MAX_SIZE, "Trace frame too small for a record");
+BUILD_ASSERT(TRACE_FRAME_PAYLOAD_SIZE <= UINT8_MAX, "Trace frame payload length is a byte");
+
+static const struct device *trace_uart = DEVICE_DT_GET(DT_NODELABEL(trace_uart));
+
+/* Encoded frames waiting for the UART. Filled by the sample producer, drained from the UART interrupt */
+RING_BUF_DECLARE(trace_ring, CONFIG_SCROLLER_TRACE_BUFFER_SIZE);
+
+/* Frame being encoded, only touched under the lock */
+static struct
+{
+    uint8_t buf[CONFIG_SCROLLER_TRACE_FRAME_SIZE];
+    size_t len;
+    uint8_t records;
+    uint8_t sequence;
+    /* Cycle count of the previous record, and uptime of the frame start */
+    uint32_t prev_cycles;
+    uint32_t start_ms;
+    /* Angle of each axis as of the previous record */
+    uint16_t angle[SCROLL_AXIS_COUNT];
+    /* Records lost since the last frame sent */
+    uint32_t dropped;
+} frame;
+
+static struct trace_stats stats;
+static struct k_spinlock lock;
+
+void trace_stats_get(struct trace_stats *out)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    *out = stats;
+    k_spin_unlock(&lock, key);
+}
+
+static size_t put_varint(uint8_t *buf, uint32_t value)
+{
+    size_t len = 0;
+
+    do
+    {
+        uint8_t byte = value & 0x7F;
+
+        value >>= 7;
+        buf[len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+
+    return len;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/* Host reading the port */
+static bool host_listening(void)
+{
+    uint32_t dtr = 0;
+
+    return uart_line_ctrl_get(trace_uart, UART_LINE_CTRL_DTR, &dtr) == 0 && dtr;
+}
+
+/* Start a frame at the current time and angles */
+static void frame_start(uint32_t now)
+{
+    uint64_t uptime_us = k_ticks_to_us_floor64(k_uptime_ticks());
+
+    frame.buf[0] = TRACE_FRAME_MAGIC;
+    frame.buf[2] = frame.sequence;
+    sys_put_le16(MIN(frame.dropped, UINT16_MAX), &frame.buf[4]);
+    sys_put_le32((uint32_t)uptime_us, &frame.buf[6]);
+    sys_put_le16(frame.angle[SCROLL_AXIS_WHEEL], &frame.buf[10]);
+    sys_put_le16(frame.angle[SCROLL_AXIS_PAN], &frame.buf[12]);
+
+    frame.len = TRACE_FRAME_HEADER_SIZE;
+    frame.records = 0;
+    frame.prev_cycles = now;
+    frame.start_ms = k_uptime_get_32();
+}
+
+/* Queue the frame for the host, or drop it whole if the ring is full */
+static void frame_flush(void)
+{
+    if (frame.records == 0)
+    {
+        return;
+    }
+
+    frame.buf[1] = frame.len - TRACE_FRAME_HEADER_SIZE;
+    frame.buf[3] = frame.records;
+
+    if (!host_listening())
+    {
+        /* Nobody to send to, not an overflow */
+        frame.dropped = 0;
+    }
+    else if (ring_buf_space_get(&trace_ring) < frame.len)
+    {
+        frame.dropped += frame.records;
+        stats.dropped += frame.records;
+    }
+    else
+    {
+        ring_buf_put(&trace_ring, frame.buf, frame.len);
+        frame.dropped = 0;
+        frame.sequence++;
+        stats.frames++;
+        uart_irq_tx_enable(trace_uart);
+    }
+
+    frame.records = 0;
+}
+
+void trace_record(enum scroll_axis axis, int32_t angle, int16_t steps)
+{
+    uint32_t now = k_cycle_get_32();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (frame.records == 0)
+    {
+        frame_start(now);
+    }
+
+    /* Wrap corrected change since the previous angle of the axis */
+    int32_t change = (int32_t)(angle & (SCROLL_ENGINE_COUNTS - 1)) - frame.angle[axis];
+
+    if (change > SCROLL_ENGINE_COUNTS / 2)
+    {
+        change -= SCROLL_ENGINE_COUNTS;
+    }
+    else if (change < -SCROLL_ENGINE_COUNTS / 2)
+    {
+        change += SCROLL_ENGINE_COUNTS;
+    }
+
+    uint32_t dt_us = k_cyc_to_us_floor32(now - frame.prev_cycles);
+    uint8_t *out = &frame.buf[frame.len];
+
+    out += put_varint(out, (dt_us << 1) | axis);
+    out += put_varint(out, zigzag(change));
+    out += put_varint(out, zigzag(steps));
+
+    frame.len = out - frame.buf;
+    frame.records++;
+    frame.prev_cycles = now;
+    frame.angle[axis] = angle & (SCROLL_ENGINE_COUNTS - 1);
+    stats.records++;
+
+    /* Send when the next record may not fit, or the frame has been open too long */
+    if (frame.len + TRACE_RECORD_MAX_SIZE > sizeof(frame.buf) || frame.records == UINT8_MAX ||
+        k_uptime_get_32() - frame.start_ms >= CONFIG_SCROLLER_TRACE_FLUSH_MS)
+    {
+        frame_flush();
+    }
+
+    k_spin_unlock(&lock, key);
+}
+
+/* Feed the UART from the ring */
+static void uart_cb(const struct device *dev, void *user_data)
+{
+    ARG_UNUSED(user_data);
+
+    while (uart_irq_update(dev) && uart_irq_tx_ready(dev))
+    {
+        uint8_t *data;
+        uint32_t len = ring_buf_get_claim(&trace_ring, &data, CONFIG_SCROLLER_TRACE_FRAME_SIZE);
+
+        if (len == 0)
+        {
+            ring_buf_get_finish(&trace_ring, 0);
+            uart_irq_tx_disable(dev);
+            break;
+        }
+
+        int sent = uart_fifo_fill(dev, data, len);
+
+        ring_buf_get_finish(&trace_ring, MAX(sent, 0));
+
+        if (sent <= 0)
+        {
+            break;
+        }
+    }
+}
+
+static int init()
+{
+    if (!device_is_ready(trace_uart))
+    {
+        LOG_ERR("Trace UART not ready");
+        return -ENODEV;
+    }
+
+    return uart_irq_callback_user_data_set(trace_uart, uart_cb, NULL);
+}
+
+static void process_module_state_event(struct module_state_event *event)
+{
+    int err;
+
+    if (check_state(event, MODULE_ID(main), MODULE_STATE_READY))
+    {
+        err = init();
+        if (err)
+        {
+            module_set_state(MODULE_STATE_ERROR);
+            LOG_ERR("Init err: %d", err);
+        }
+        else
+        {
+            module_set_state(MODULE_STATE_READY);
+        }
+    }
+}
+
+/* Sampling stops, send the partial frame instead of holding it until the next wake */
+static void process_power_down_event(struct power_down_event *event)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    frame_flush();
+    k_spin_unlock(&lock, key);
+
+    if (stats.dropped)
+    {
+        LOG_WRN("Trace records dropped: %u of %u", stats.dropped, stats.records);
+    }
+}
+
+static bool app_event_handler(const struct app_event_header *aeh)
+{
+    if (is_module_state_event(aeh))
+    {
+        struct module_state_event *event = cast_module_state_event(aeh);
+        process_module_state_event(event);
+    }
+    else if (is_power_down_event(aeh))
+    {
+        struct power_down_event *event = cast_power_down_event(aeh);
+        process_power_down_event(event);
+    }
+
+    /* Don't consume the event */
+    return false;
+}
+APP_EVENT_LISTENER(MODULE, app_event_handler);
+APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
+APP_EVENT_SUBSCRIBE(MODULE, power_down_event);
@@ -0,0 +1,70 @@
+#ifndef SCROLLER_TRACE_H
+#define SCROLLER_TRACE_H
+
+#include <stdint.h>
+
+#include "scroller_config.h"
+
+/*
+ * Raw angle trace, streamed on its own CDC ACM port while the host holds DTR.
+ *
+ * The stream is a sequence of frames, all fields little endian:
+ *
+ *   u8  magic, TRACE_FRAME_MAGIC
+ *   u8  payload length in bytes, after the header
+ *   u8  sequence number, increments per frame sent
+ *   u8  record count
+ *   u16 records dropped before this frame, saturating
+ *   u32 timestamp of the frame start (us since boot)
+ *   u16 angle of each axis at the frame start
+ *
+ * followed by the records, each made of three LEB128 varints:
+ *
+ *   (time since the previous record in us << 1) | axis
+ *   zigzag angle change of the axis, wrap corrected
+ *   zigzag steps emitted by the sample
+ *
+ * scripts/trace_decode.py turns the stream into CSV.
+ */
+#define TRACE_FRAME_MAGIC 0xA5
+#define TRACE_FRAME_HEADER_SIZE 14
+
+/* Trace counters */
+struct trace_stats
+{
+    /* Records written into frames */
+    uint32_t records;
+    /* Frames queued for the host */
+    uint32_t frames;
+    /* Records lost because the ring was full */
+    uint32_t dropped;
+};
+
+#ifdef CONFIG_SCROLLER_TRACE
+/**
+ * @brief Record a processed sample.
+ *
+ * Never blocks, a frame that doesn't fit in the ring is dropped and counted.
+ *
+ * @param axis  Axis of the sample
+ * @param angle Raw sensor angle
+ * @param steps Steps the sample emitted
+ */
+void trace_record(enum scroll_axis axis, int32_t angle, int16_t steps);
+
+/**
+ * @brief Read the trace counters.
+ *
+ * @param stats Output for the counters
+ */
+void trace_stats_get(struct trace_stats *stats);
+#else
+static inline void trace_record(enum scroll_axis axis, int32_t angle, int16_t steps)
+{
+    (void)axis;
+    (void)angle;
+    (void)steps;
+}
+#endif
+
+#endif /* SCROLLER_TRACE_H */
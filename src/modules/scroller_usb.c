@@ -3,15 +3,19 @@
 
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
 LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_DBG);
 
-#include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/usbd.h>
-#include <zephyr/usb/class/usb_hid.h>
+#include <zephyr/usb/class/usbd_hid.h>
 
 #include "usb_state_event.h"
 #include "scroller_config.h"
-#include "scroller_scroll_calculate.h"
+#include "scroller_step_accumulator.h"
+#include "scroller_acquire.h"
+#include "scroller_latency.h"
+#include "scroller_profile.h"
+#include "scroller_usb.h"
 #include <caf/events/force_power_down_event.h>
 #include <caf/events/power_event.h>
 
@@ -23,92 +27,317 @@ static enum usb_state USB_STATE;
 /* USB HID report descriptor bytes */
 static const uint8_t hid_report_desc[] = HID_WHEEL_REPORT_DESC();
 
-/* Mouse Report */
+/* USB device context and descriptors */
+USBD_DEVICE_DEFINE(scroller_usbd, DEVICE_DT_GET(DT_NODELABEL(zephyr_udc0)),
+                   CONFIG_SCROLLER_USB_VID, CONFIG_SCROLLER_USB_PID);
+USBD_DESC_LANG_DEFINE(scroller_lang);
+USBD_DESC_MANUFACTURER_DEFINE(scroller_mfr, CONFIG_SCROLLER_USB_MANUFACTURER);
+USBD_DESC_PRODUCT_DEFINE(scroller_product, CONFIG_SCROLLER_USB_PRODUCT);
+USBD_DESC_CONFIG_DEFINE(scroller_fs_cfg_desc, "FS Configuration");
+USBD_CONFIGURATION_DEFINE(scroller_fs_config,
+                          IS_ENABLED(CONFIG_SCROLLER_USB_REMOTE_WAKEUP) ? USB_SCD_REMOTE_WAKEUP : 0,
+                          100, &scroller_fs_cfg_desc);
+
+/* HID device instance */
+static const struct device *hid_dev = DEVICE_DT_GET(SCROLLER_HID_NODE);
+
+/* Mouse Report, both axes in one report */
 struct __packed wheel_report_t
 {
     uint8_t report_id;
     int16_t wheel;
+    int16_t pan;
 };
 
-/* Semaphore for writing reports over USB.
- * When a write on the IN endpoint is started, take the semaphore,
- * When all data is written to the IN endpoint, release the semaphore.
+/* Report buffer, left untouched until the host has collected the report in it. A single buffer by
+ * design: a second report queued behind it would go out a poll later with steps already a poll old,
+ * while steps held back in the accumulator go out in the next report with everything since.
  */
-static K_SEM_DEFINE(ep_write_sem, 0, 1);
+UDC_STATIC_BUF_DEFINE(report_buf, sizeof(struct wheel_report_t));
+
+/* Report slot, taken when a report is submitted and given back on IN completion.
+ * Only one report is in flight so the next one drains the freshest steps.
+ */
+static K_SEM_DEFINE(report_slot_sem, 1, 1);
+
+/* Set while a report is submitted, and aborted when the bus resets or suspends under it. The
+ * completion of an aborted report only frees the slot, it was never collected on time.
+ */
+static atomic_t report_inflight;
+static atomic_t report_aborted;
+
+static void abort_inflight_report(void)
+{
+    if (atomic_get(&report_inflight))
+    {
+        atomic_set(&report_aborted, 1);
+    }
+}
 
 /* Stack for USB thread*/
-// FIXME: kconfig for stack size
-static K_THREAD_STACK_DEFINE(usb_thread_stack, 1024);
+static K_THREAD_STACK_DEFINE(usb_thread_stack, CONFIG_SCROLLER_USB_STACK_SIZE);
 static struct k_thread usb_thread;
 
-/* Callback for IN endpoint transfer completion */
-static void int_in_ready_cb(const struct device *dev)
+/* Report counters */
+static struct usb_report_stats report_stats = {.interval_min_us = UINT32_MAX};
+
+void usb_report_stats_get(struct usb_report_stats *stats)
+{
+    *stats = report_stats;
+}
+
+/* Cycle count of the oldest sample in the report being written */
+static uint32_t inflight_sample_cycles;
+
+/* Age of the oldest sample in each report when the host collects it */
+static struct
+{
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t count;
+} sample_age = {.min_us = UINT32_MAX};
+
+static void record_sample_age(void)
+{
+    uint32_t age_us = k_cyc_to_us_floor32(k_cycle_get_32() - inflight_sample_cycles);
+
+    sample_age.min_us = MIN(sample_age.min_us, age_us);
+    sample_age.max_us = MAX(sample_age.max_us, age_us);
+    sample_age.total_us += age_us;
+    sample_age.count++;
+}
+
+/* Host polling interval, and the gap after which reports no longer count as back to back */
+#define POLL_INTERVAL_US DT_PROP(SCROLLER_HID_NODE, in_polling_period_us)
+#define REPORT_BURST_GAP_US (4 * POLL_INTERVAL_US)
+
+/* Cycle count of the previous report collected */
+static uint32_t prev_report_cycles;
+
+static void record_report_interval(void)
+{
+    uint32_t now = k_cycle_get_32();
+    uint32_t interval_us = k_cyc_to_us_floor32(now - prev_report_cycles);
+
+    prev_report_cycles = now;
+
+    /* Longer gaps are pauses in scrolling, not jitter */
+    if (!report_stats.reports || interval_us > REPORT_BURST_GAP_US)
+    {
+        return;
+    }
+
+    report_stats.interval_min_us = MIN(report_stats.interval_min_us, interval_us);
+    report_stats.interval_max_us = MAX(report_stats.interval_max_us, interval_us);
+    report_stats.interval_total_us += interval_us;
+    report_stats.intervals++;
+
+    if (interval_us > POLL_INTERVAL_US + POLL_INTERVAL_US / 2)
+    {
+        report_stats.late++;
+    }
+}
+
+static void log_report_intervals(void)
+{
+    if (report_stats.intervals == 0)
+    {
+        return;
+    }
+
+    LOG_INF("Report interval (us) min: %u, avg: %u, max: %u, late: %u of %u", report_stats.interval_min_us,
+            (uint32_t)(report_stats.interval_total_us / report_stats.intervals), report_stats.interval_max_us,
+            report_stats.late, report_stats.intervals);
+}
+
+#ifdef CONFIG_SCROLLER_USB_REMOTE_WAKEUP
+/* Cycle count of the remote wakeup request, zero when none is pending */
+static uint32_t wakeup_cycles;
+#endif
+
+static void log_sample_age(void)
+{
+    if (sample_age.count == 0)
+    {
+        return;
+    }
+
+    LOG_INF("Sample age at transmit (us) min: %u, avg: %u, max: %u, reports: %u",
+            sample_age.min_us, (uint32_t)(sample_age.total_us / sample_age.count),
+            sample_age.max_us, sample_age.count);
+}
+
+/* Callback for IN report completion */
+static void input_report_done_cb(const struct device *dev, const uint8_t *const report)
 {
     ARG_UNUSED(dev);
-    /* Release the write semaphore allowing another write to occur */
-    k_sem_give(&ep_write_sem);
+    ARG_UNUSED(report);
+
+    atomic_clear(&report_inflight);
+
+    /* Cancelled by a bus reset or held over a suspend, not a poll */
+    if (atomic_clear(&report_aborted))
+    {
+        k_sem_give(&report_slot_sem);
+        return;
+    }
+
+    record_sample_age();
+    record_report_interval();
+    latency_mark(LATENCY_STAGE_IN_COMPLETE);
+    report_stats.reports++;
+
+#ifdef CONFIG_SCROLLER_USB_REMOTE_WAKEUP
+    /* First report collected after waking the host */
+    if (wakeup_cycles)
+    {
+        LOG_INF("Remote wakeup to first report: %u us", k_cyc_to_us_floor32(k_cycle_get_32() - wakeup_cycles));
+        wakeup_cycles = 0;
+    }
+#endif
+
+#ifdef CONFIG_SCROLLER_SAMPLE_SOF_SYNC
+    /* The host just polled, lock the sampling phase to it */
+    acquire_in_complete();
+#endif
+
+    /* Release the report slot, the sender submits the next report right away */
+    k_sem_give(&report_slot_sem);
 }
 
-/* Callback for Get_Report requests */
-static int get_report_cb(const struct device *dev, struct usb_setup_packet *setup, int32_t *len, uint8_t **data)
+/* Callback for the HID interface being enabled or disabled by the host */
+static void iface_ready_cb(const struct device *dev, const bool ready)
 {
     ARG_UNUSED(dev);
-    ARG_UNUSED(len);
-    ARG_UNUSED(data);
 
-    /* Get the feature report (0x0300) with report ID 2 (0x0002)*/
-    if (setup->wValue == 0x0302)
+    /* Reports in flight are cancelled when the interface goes down */
+    if (!ready)
     {
-        // FIXME: Respond with the resolution multiplier
-        LOG_INF("GET_REPORT: Resolution Multiplier");
+        abort_inflight_report();
+        k_sem_give(&report_slot_sem);
     }
 
-    return 0;
+    LOG_INF("HID interface %s", ready ? "ready" : "not ready");
+}
+
+#ifdef CONFIG_SCROLLER_SAMPLE_SOF_SYNC
+/* Callback for USB start of frame */
+static void sof_cb(const struct device *dev)
+{
+    ARG_UNUSED(dev);
+
+    /* Frame timing for the sample schedule */
+    acquire_sof();
+}
+#endif
+
+#ifdef CONFIG_SCROLLER_LATENCY_STATS
+/* Latency statistics feature report, filled on request */
+static struct latency_report_t latency_report;
+#endif
+
+/* Callback for Get_Report requests, returns the report length */
+static int get_report_cb(const struct device *dev, const uint8_t type, const uint8_t id, const uint16_t len,
+                         uint8_t *const buf)
+{
+    ARG_UNUSED(dev);
+
+    if (type != HID_REPORT_TYPE_FEATURE)
+    {
+        return -ENOTSUP;
+    }
+
+    /* Resolution multiplier feature report */
+    if (id == SCROLLER_RESOLUTION_MULTIPLIER_REPORT_ID && len >= 1 + SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE)
+    {
+        buf[0] = id;
+        scroller_config_get_res_mult(&buf[1]);
+
+        return 1 + SCROLLER_RESOLUTION_MULTIPLIER_REPORT_SIZE;
+    }
+
+#ifdef CONFIG_SCROLLER_LATENCY_STATS
+    /* Latency statistics feature report */
+    if (id == SCROLLER_LATENCY_REPORT_ID && len >= sizeof(struct latency_report_t))
+    {
+        latency_report_fill((struct latency_report_t *)buf);
+
+        return sizeof(struct latency_report_t);
+    }
+#endif
+
+    return -ENOTSUP;
 }
 
 /* Callback for Set_Report requests */
-static int set_report_cb(const struct device *dev, struct usb_setup_packet *setup, int32_t *len, uint8_t **data)
+static int set_report_cb(const struct device *dev, const uint8_t type, const uint8_t id, const uint16_t len,
+                         const uint8_t *const buf)
 {
     ARG_UNUSED(dev);
-    ARG_UNUSED(setup);
 
-    /* Check to see if the first byte is 0x02, the report id for the Resolution Multiplier report
-     * and enable high res scrolling if the next value is greater than 0. Linux and Windows use a fixed 120
-     * high res scrolls per basic scroll so the set value resolution multiplier doesn't matter here
+    /* Check to see if this is report id 2, the Resolution Multiplier report, and enable high res
+     * scrolling if the value is greater than 0. Linux and Windows use a fixed 120 high res scrolls
+     * per basic scroll so the set value resolution multiplier doesn't matter here
      */
-    // FIXME: Better check here, and check the length of the data to make sure its not overrunning
-    if ((*data)[0] == 0x02 && (*data)[1] > 0)
+    if (type == HID_REPORT_TYPE_FEATURE && id == SCROLLER_RESOLUTION_MULTIPLIER_REPORT_ID && len > 0 &&
+        !scroller_config_set_res_mult(&buf[1], len - 1))
     {
-        LOG_INF("HI-res enabled");
-        SCROLLER_CONFIG.internal_divider = SCROLLER_STEPS_HI_RES;
+        LOG_INF("HI-res %s", scroller_config_is_hi_res() ? "enabled" : "disabled");
     }
 
     return 0;
 }
 
 /* Registers HID callback */
-static const struct hid_ops ops = {
+static const struct hid_device_ops ops = {
+    .iface_ready = iface_ready_cb,
     .get_report = get_report_cb,
     .set_report = set_report_cb,
-    .int_in_ready = int_in_ready_cb,
+    .input_report_done = input_report_done_cb,
+#ifdef CONFIG_SCROLLER_SAMPLE_SOF_SYNC
+    .sof = sof_cb,
+#endif
 };
 
-int send_report(const struct device *hid_dev, uint8_t *report, size_t report_size)
+#ifdef CONFIG_SCROLLER_USB_HOST_EMUL
+/* Emulated host, collects the report in flight on each poll. Test only, the report never reaches usbd */
+static void host_emul_poll_fn(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    if (atomic_get(&report_inflight))
+    {
+        input_report_done_cb(hid_dev, report_buf);
+    }
+}
+static K_WORK_DEFINE(host_emul_poll, host_emul_poll_fn);
+
+static void host_emul_timer_fn(struct k_timer *timer)
+{
+    ARG_UNUSED(timer);
+
+    /* Completions come from a thread on the device stack as well */
+    k_work_submit(&host_emul_poll);
+}
+static K_TIMER_DEFINE(host_emul_timer, host_emul_timer_fn, NULL);
+#endif
+
+/* Submit a report without waiting for the host to collect it */
+int send_report(uint8_t *report, size_t report_size)
 {
     int err;
 
-    /* Write the report to the HID interrupt endpoint */
-    err = hid_int_ep_write(hid_dev, report, report_size, NULL);
+    /* Queue the report on the HID interrupt endpoint */
+    latency_mark(LATENCY_STAGE_EP_WRITE);
+    atomic_set(&report_inflight, 1);
+    err = IS_ENABLED(CONFIG_SCROLLER_USB_HOST_EMUL) ? 0 : hid_device_submit_report(hid_dev, report_size, report);
     if (err)
     {
+        atomic_clear(&report_inflight);
         LOG_ERR("HID write error, %d", err);
         return err;
     }
-    else
-    {
-        /* Wait for the write to complete */
-        k_sem_take(&ep_write_sem, K_FOREVER);
-    }
 
     return 0;
 }
@@ -116,90 +345,108 @@ int send_report(const struct device *hid_dev, uint8_t *report, size_t report_siz
 /* USB HID report sending thread */
 void usb_thread_fn()
 {
-    const struct device *hid_dev;
     int err;
 
     LOG_INF("USB_Thread Started");
 
-    struct wheel_report_t wheel_report = {
-        .report_id = 0x01,
-        .wheel = 0,
-    };
-
-    /* Get the usb hid device binding */
-    hid_dev = device_get_binding("HID_0");
-
-    if (hid_dev == NULL)
+    while (1)
     {
-        LOG_ERR("Cannot get USB device binding");
-        return;
-    }
+        int16_t steps[SCROLL_AXIS_COUNT];
 
-    UDC_STATIC_BUF_DEFINE(report, sizeof(wheel_report));
+        /* Wait until the previous report has been collected by the host */
+        k_sem_take(&report_slot_sem, K_FOREVER);
 
-    while (1)
-    {
-        int16_t steps;
-        /* Wait for a message to be available */
-        err = k_msgq_get(&step_msgq, &steps, K_FOREVER);
+        /* Wait for steps and drain everything pending into this report. Steps arriving while
+         * a report is in flight keep merging in the accumulator until the slot frees up.
+         */
+        err = step_accumulator_get(steps, &inflight_sample_cycles, K_FOREVER);
         if (err)
         {
-            LOG_WRN("Recieve error: %d", err);
+            k_sem_give(&report_slot_sem);
+            continue;
         }
+        latency_mark(LATENCY_STAGE_DEQUEUE);
+        uint64_t profile_start = profile_begin();
 
-        wheel_report.wheel = steps;
+        /* The previous report has been collected, its buffer is free */
+        struct wheel_report_t *wheel_report = (struct wheel_report_t *)report_buf;
 
-        /* Copy the report to the static buffer */
-        memcpy(report, &wheel_report, sizeof(wheel_report));
+        wheel_report->report_id = SCROLLER_WHEEL_REPORT_ID;
+        wheel_report->wheel = sys_cpu_to_le16(steps[SCROLL_AXIS_WHEEL]);
+        wheel_report->pan = sys_cpu_to_le16(steps[SCROLL_AXIS_PAN]);
 
-        err = send_report(hid_dev, report, sizeof(wheel_report));
+        err = send_report((uint8_t *)wheel_report, sizeof(struct wheel_report_t));
+        profile_end(PROFILE_SECTION_SEND, profile_start);
         if (err)
         {
+            k_sem_give(&report_slot_sem);
+
+            /* Bus suspended under the sender, keep the steps for after the resume */
+            if (usbd_is_suspended(&scroller_usbd))
+            {
+                for (int axis = 0; axis < SCROLL_AXIS_COUNT; axis++)
+                {
+                    step_accumulator_put(axis, steps[axis]);
+                }
+                k_thread_suspend(k_current_get());
+                continue;
+            }
+
+            report_stats.dropped++;
             LOG_WRN("Dropped report: %d", err);
+            continue;
         }
+        profile_report();
     }
 }
 
-/* Take the status reported by the callback and process it */
-static inline void status_cb(enum usb_dc_status_code status, const uint8_t *param)
+/* Take the message reported by the USB stack and process it */
+static void msg_cb(struct usbd_context *const ctx, const struct usbd_msg *const msg)
 {
-    ARG_UNUSED(param);
     enum usb_state transition;
     static enum usb_state before_suspend;
 
-    switch (status)
+    switch (msg->type)
     {
-    case USB_DC_UNKNOWN:
-        /* Connection status unknown */
-        transition = USB_STATE_DISCONNECTED;
-        break;
-    case USB_DC_CONNECTED:
+    case USBD_MSG_VBUS_READY:
         /* Physically connected */
+        if (usbd_can_detect_vbus(ctx) && usbd_enable(ctx))
+        {
+            LOG_ERR("Failed to enable USB");
+        }
         transition = USB_STATE_POWER_ONLY;
         break;
-    case USB_DC_RESET:
-        /* Reset device state to defaults */
-        transition = USB_STATE_POWER_ONLY;
-        break;
-    case USB_DC_CONFIGURED:
-        /* Device configured for data transfer */
-        transition = USB_STATE_CONFIGURED;
-        break;
-    case USB_DC_DISCONNECTED:
+    case USBD_MSG_VBUS_REMOVED:
         /* Physically disconnected */
+        if (usbd_can_detect_vbus(ctx) && usbd_disable(ctx))
+        {
+            LOG_ERR("Failed to disable USB");
+        }
         transition = USB_STATE_DISCONNECTED;
         break;
-    case USB_DC_SUSPEND:
-        /* Suspend the device, does not change configuration just pauses connection */
+    case USBD_MSG_RESET:
+        /* Reset device state to defaults, cancels the report in flight */
+        abort_inflight_report();
+        transition = USB_STATE_POWER_ONLY;
+        break;
+    case USBD_MSG_CONFIGURATION:
+        /* Device configured for data transfer, configuration 0 deconfigures */
+        transition = msg->status ? USB_STATE_CONFIGURED : USB_STATE_POWER_ONLY;
+        break;
+    case USBD_MSG_SUSPEND:
+        /* Suspend the device, does not change configuration just pauses connection. A report in
+         * flight waits out the suspend.
+         */
+        abort_inflight_report();
         before_suspend = USB_STATE;
         transition = USB_STATE_SUSPENDED;
         break;
-    case USB_DC_RESUME:
+    case USBD_MSG_RESUME:
         /* Resume the device, no configuration change */
         transition = before_suspend;
         break;
     default:
-        LOG_WRN("Unhandled USB state: %d", status);
+        LOG_DBG("Unhandled USB message: %s", usbd_msg_type_string(msg->type));
         return;
     }
 
@@ -231,14 +478,35 @@ void process_usb_state_event(struct usb_state_event *event)
         break;
     }
 
+    case USB_STATE_SUSPENDED:
+    {
+        log_sample_age();
+        log_report_intervals();
+
+        /* Stop the sender and then the sensor, the idle waker watches the wheel while the bus is
+         * suspended. Pending steps stay in the accumulator until the host resumes.
+         */
+        k_thread_suspend(&usb_thread);
+        struct force_power_down_event *event = new_force_power_down_event();
+        APP_EVENT_SUBMIT(event);
+
+        break;
+    }
+
     default:
-        /* Don't re-suspend the device */
+        log_sample_age();
+        log_report_intervals();
+
+        /* Stop the sender on every exit from configured, only one transport drains the step
+         * accumulator
+         */
+        k_thread_suspend(&usb_thread);
+
+        /* Don't re-suspend the device, BLE may take over from configured */
         if (USB_STATE != USB_STATE_CONFIGURED)
         {
-            /* Stop the sender and then the sensor to avoid HID errors from trying to send data when suspended */
             struct force_power_down_event *event = new_force_power_down_event();
             APP_EVENT_SUBMIT(event);
-            k_thread_suspend(&usb_thread);
         }
 
         break;
@@ -247,42 +515,153 @@ void process_usb_state_event(struct usb_state_event *event)
     USB_STATE = event->state;
 }
 
-/* USB initialization */
-static int init()
+#ifdef CONFIG_SCROLLER_USB_REMOTE_WAKEUP
+/* Wheel motion while the bus is suspended, ask the host to resume it */
+static void process_wake_up_event(struct wake_up_event *event)
 {
-    const struct device *hid_dev;
     int err;
 
-    /* Get the usb hid device binding */
-    hid_dev = device_get_binding("HID_0");
+    if (USB_STATE != USB_STATE_SUSPENDED)
+    {
+        return;
+    }
 
-    if (hid_dev == NULL)
+    /* Fails with -EACCES unless the host enabled remote wakeup before suspending */
+    err = usbd_wakeup_request(&scroller_usbd);
+    if (err)
     {
-        LOG_ERR("Cannot get USB device binding");
-        return -EINVAL;
+        LOG_WRN("Remote wakeup failed: %d", err);
+
+        /* The bus stays suspended, go back to sleep within the suspend current budget
+         * instead of waiting for the power manager timeout
+         */
+        struct force_power_down_event *event = new_force_power_down_event();
+        APP_EVENT_SUBMIT(event);
+
+        return;
     }
 
-    /* Attach the HID report descriptor to the HID device */
-    usb_hid_register_device(hid_dev,
-                            hid_report_desc, sizeof(hid_report_desc),
-                            &ops);
+    /* Measure from the first request, never zero while pending */
+    if (!wakeup_cycles)
+    {
+        wakeup_cycles = k_cycle_get_32() | 1;
+    }
+    LOG_INF("Remote wakeup requested");
+}
+#endif
+
+/* USB device stack initialization */
+static int usbd_setup(void)
+{
+    int err;
 
-    /* Initialize HID device */
-    err = usb_hid_init(hid_dev);
-    if (err < 0)
+    /* Device descriptors */
+    err = usbd_add_descriptor(&scroller_usbd, &scroller_lang);
+    err = err ? err : usbd_add_descriptor(&scroller_usbd, &scroller_mfr);
+    err = err ? err : usbd_add_descriptor(&scroller_usbd, &scroller_product);
+    if (err)
     {
-        LOG_ERR("Cannot initialize USB HID");
+        LOG_ERR("Failed to add USB descriptors");
         return err;
     }
 
-    err = usb_enable(status_cb);
-    if (err < 0)
+    err = usbd_add_configuration(&scroller_usbd, USBD_SPEED_FS, &scroller_fs_config);
+    if (err)
     {
-        LOG_ERR("Failed to enable USB");
+        LOG_ERR("Failed to add USB configuration");
+        return err;
     }
 
+    err = usbd_register_all_classes(&scroller_usbd, USBD_SPEED_FS, 1, NULL);
+    if (err)
+    {
+        LOG_ERR("Failed to register USB classes");
+        return err;
+    }
+
+    if (IS_ENABLED(CONFIG_USBD_CDC_ACM_CLASS))
+    {
+        /* Composite HID and CDC ACM, the CDC interfaces are grouped by an interface association */
+        usbd_device_set_code_triple(&scroller_usbd, USBD_SPEED_FS, USB_BCC_MISCELLANEOUS, 0x02, 0x01);
+    }
+    else
+    {
+        /* Class codes come from the HID interface descriptor */
+        usbd_device_set_code_triple(&scroller_usbd, USBD_SPEED_FS, 0, 0, 0);
+    }
+
+    err = usbd_msg_register_cb(&scroller_usbd, msg_cb);
+    if (err)
+    {
+        LOG_ERR("Failed to register USB message callback");
+        return err;
+    }
+
+    err = usbd_init(&scroller_usbd);
+    if (err)
+    {
+        LOG_ERR("Failed to initialize USB");
+        return err;
+    }
+
+    /* Without VBUS detection the stack is enabled right away, otherwise on VBUS ready */
+    if (!usbd_can_detect_vbus(&scroller_usbd))
+    {
+        err = usbd_enable(&scroller_usbd);
+        if (err)
+        {
+            LOG_ERR("Failed to enable USB");
+        }
+    }
+
+    return err;
+}
+
+#ifdef CONFIG_SCROLLER_USB_HOST_EMUL
+/* Configure the device and poll it from the emulated host */
+static int host_emul_start(void)
+{
+    struct usb_state_event *event = new_usb_state_event();
+
+    LOG_INF("Emulated host polling every %u us", POLL_INTERVAL_US);
+
+    event->state = USB_STATE_CONFIGURED;
+    APP_EVENT_SUBMIT(event);
+    k_timer_start(&host_emul_timer, K_USEC(POLL_INTERVAL_US), K_USEC(POLL_INTERVAL_US));
+
+    return 0;
+}
+#else
+static inline int host_emul_start(void)
+{
+    return -ENOTSUP;
+}
+#endif
+
+/* USB initialization */
+static int init()
+{
+    int err;
+
+    if (!device_is_ready(hid_dev))
+    {
+        LOG_ERR("HID device not ready");
+        return -ENODEV;
+    }
+
+    /* Attach the HID report descriptor to the HID device */
+    err = hid_device_register(hid_dev, hid_report_desc, sizeof(hid_report_desc), &ops);
+    if (err)
+    {
+        LOG_ERR("Cannot register HID device");
+        return err;
+    }
+
+    /* Nothing enumerates the device on native_sim, the emulated host stands in for the stack */
+    err = IS_ENABLED(CONFIG_SCROLLER_USB_HOST_EMUL) ? host_emul_start() : usbd_setup();
+
     /* USB thread */
-    k_thread_create(&usb_thread, usb_thread_stack, 1024,
+    k_thread_create(&usb_thread, usb_thread_stack, K_THREAD_STACK_SIZEOF(usb_thread_stack),
                     (k_thread_entry_t)usb_thread_fn, NULL, NULL, NULL,
                     SCROLLER_SEND_THREAD_PRIORITY, 0, K_NO_WAIT);
     k_thread_name_set(&usb_thread, "usb_sender");
@@ -329,6 +708,14 @@ static bool app_event_handler(const struct app_event_header *aeh)
         process_usb_state_event(event);
     }
 
+#ifdef CONFIG_SCROLLER_USB_REMOTE_WAKEUP
+    if (is_wake_up_event(aeh))
+    {
+        struct wake_up_event *event = cast_wake_up_event(aeh);
+        process_wake_up_event(event);
+    }
+#endif
+
     /* Don't consume the event */
     return false;
 }
@@ -337,3 +724,7 @@ APP_EVENT_LISTENER(MODULE, app_event_handler);
 APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
 /* Listen for usb_state_events */
 APP_EVENT_SUBSCRIBE(MODULE, usb_state_event);
+#ifdef CONFIG_SCROLLER_USB_REMOTE_WAKEUP
+/* Listen for wheel motion while suspended */
+APP_EVENT_SUBSCRIBE(MODULE, wake_up_event);
+#endif
@@ -0,0 +1,29 @@
+#ifndef SCROLLER_USB_H
+#define SCROLLER_USB_H
+
+#include <stdint.h>
+
+/* USB HID report counters */
+struct usb_report_stats
+{
+    /* Reports collected by the host */
+    uint32_t reports;
+    /* Reports the HID class refused */
+    uint32_t dropped;
+    /* Time between reports collected back to back, the report rate stability while scrolling */
+    uint32_t interval_min_us;
+    uint32_t interval_max_us;
+    uint64_t interval_total_us;
+    uint32_t intervals;
+    /* Back to back reports collected more than half a polling interval late */
+    uint32_t late;
+};
+
+/**
+ * @brief Read the USB HID report counters.
+ *
+ * @param stats Output for the counters
+ */
+void usb_report_stats_get(struct usb_report_stats *stats);
+
+#endif /* SCROLLER_USB_H */
@@ -0,0 +1,356 @@
+#include "scroll_replay.h"
+
+#include <string.h>
+
+/* Report fields are int16, like the HID wheel report */
+#define REPORT_MAX INT16_MAX
+#define REPORT_MIN INT16_MIN
+
+/* Wheel samples per speed ripple window */
+#define RIPPLE_WINDOW 16
+
+/* Synthetic gesture length */
+#define GESTURE_US 1000000
+
+static const char *const gesture_names[REPLAY_GESTURE_COUNT] = {
+    [REPLAY_GESTURE_JITTER] = "jitter",
+    [REPLAY_GESTURE_SLOW] = "slow",
+    [REPLAY_GESTURE_SPIN] = "spin",
+    [REPLAY_GESTURE_FLICK] = "flick",
+    [REPLAY_GESTURE_PAN] = "pan",
+    [REPLAY_GESTURE_WOBBLE] = "wobble",
+};
+
+/* Pipeline state, the firmware's per axis engines and the step accumulator */
+struct replay_state
+{
+    struct scroll_engine engines[SCROLL_REPLAY_AXES];
+    uint32_t prev_time_us[SCROLL_REPLAY_AXES];
+    int32_t pending[SCROLL_REPLAY_AXES];
+    /* Wheel distance of the current ripple window */
+    int32_t window_counts;
+    uint32_t window_samples;
+    uint32_t next_poll_us;
+    /* Distance lag, the wheel position is walked forward to each reported distance */
+    const struct replay_sample *samples;
+    size_t count;
+    int32_t divider;
+    bool lag_enabled;
+    size_t lag_index;
+    struct scroll_engine lag_engine;
+    int64_t lag_counts;
+    uint32_t lag_time_us;
+    int64_t reported_counts;
+};
+
+static int64_t abs64(int64_t value)
+{
+    return value < 0 ? -value : value;
+}
+
+/* Take up to an int16 worth of pending steps, carrying the rest */
+static int16_t take_pending(int32_t *pending, struct replay_metrics *metrics)
+{
+    int32_t steps = *pending;
+
+    if (steps > REPORT_MAX)
+    {
+        steps = REPORT_MAX;
+        metrics->carried++;
+    }
+    else if (steps < REPORT_MIN)
+    {
+        steps = REPORT_MIN;
+        metrics->carried++;
+    }
+
+    *pending -= steps;
+
+    return (int16_t)steps;
+}
+
+/* Time from the wheel reaching the reported distance to the report */
+static void record_lag(struct replay_state *state, int16_t steps, struct replay_metrics *metrics)
+{
+    if (!state->lag_enabled || !steps)
+    {
+        return;
+    }
+
+    /* Distances are only ordered in time while the motion keeps one direction */
+    if ((state->reported_counts > 0 && steps < 0) || (state->reported_counts < 0 && steps > 0))
+    {
+        state->lag_enabled = false;
+        metrics->lag_reports = 0;
+        return;
+    }
+
+    int64_t reported = state->reported_counts += (int64_t)steps * state->divider;
+
+    while ((reported > 0 ? state->lag_counts < reported : state->lag_counts > reported) &&
+           state->lag_index < state->count)
+    {
+        const struct replay_sample *sample = &state->samples[state->lag_index++];
+
+        if (sample->axis == 0)
+        {
+            state->lag_counts += scroll_engine_delta(&state->lag_engine, sample->angle);
+            state->lag_time_us = sample->time_us;
+        }
+    }
+
+    /* The wheel never got there, prediction ran past the end of the motion */
+    if (reported > 0 ? state->lag_counts < reported : state->lag_counts > reported)
+    {
+        return;
+    }
+
+    int32_t lag_us = (int32_t)(state->next_poll_us - state->lag_time_us);
+
+    if (!metrics->lag_reports || lag_us < metrics->lag_min_us)
+    {
+        metrics->lag_min_us = lag_us;
+    }
+    if (!metrics->lag_reports || lag_us > metrics->lag_max_us)
+    {
+        metrics->lag_max_us = lag_us;
+    }
+    metrics->lag_total_us += lag_us;
+    metrics->lag_reports++;
+}
+
+/* Host poll, reports whatever is pending */
+static void poll(struct replay_state *state, replay_report_cb report, void *user_data,
+                 struct replay_metrics *metrics)
+{
+    int16_t steps[SCROLL_REPLAY_AXES];
+    bool any = false;
+
+    for (int axis = 0; axis < SCROLL_REPLAY_AXES; axis++)
+    {
+        steps[axis] = take_pending(&state->pending[axis], metrics);
+        any |= steps[axis] != 0;
+
+        uint32_t magnitude = (uint32_t)abs64(steps[axis]);
+        if (magnitude > metrics->max_report_steps)
+        {
+            metrics->max_report_steps = magnitude;
+        }
+    }
+
+    if (!any)
+    {
+        return;
+    }
+
+    metrics->reports++;
+    record_lag(state, steps[0], metrics);
+
+    if (report)
+    {
+        report(user_data, state->next_poll_us, steps);
+    }
+}
+
+int scroll_replay_run(const struct replay_config *config, const struct replay_sample *samples, size_t count,
+                      replay_report_cb report, void *user_data, struct replay_metrics *metrics)
+{
+    struct replay_state state;
+
+    memset(metrics, 0, sizeof(*metrics));
+
+    if (config->divider <= 0 || !config->report_interval_us)
+    {
+        return -1;
+    }
+
+    memset(&state, 0, sizeof(state));
+    for (int axis = 0; axis < SCROLL_REPLAY_AXES; axis++)
+    {
+        scroll_engine_init(&state.engines[axis]);
+        state.engines[axis].linearize = config->linearize[axis];
+        state.engines[axis].accel = config->accel;
+        state.engines[axis].filter.deadband = config->deadband;
+        state.engines[axis].predict = (struct scroll_predict){
+            .lead_us = config->predict_lead_us,
+            .alpha_q8 = config->predict_alpha_q8,
+            .beta_q8 = config->predict_beta_q8,
+            .max_lead = config->predict_max_lead,
+        };
+    }
+
+    scroll_engine_init(&state.lag_engine);
+    state.samples = samples;
+    state.count = count;
+    state.divider = config->divider;
+    state.lag_enabled = !config->accel;
+
+    if (!count)
+    {
+        return 0;
+    }
+
+    uint32_t start_us = samples[0].time_us;
+    uint32_t prev_us = start_us;
+
+    state.next_poll_us = start_us + config->report_interval_us;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct replay_sample *sample = &samples[i];
+
+        if (sample->axis >= SCROLL_REPLAY_AXES || (int32_t)(sample->time_us - prev_us) < 0)
+        {
+            return -1;
+        }
+        prev_us = sample->time_us;
+
+        /* Polls due before this sample see only the steps so far */
+        while ((int32_t)(sample->time_us - state.next_poll_us) >= 0)
+        {
+            poll(&state, report, user_data, metrics);
+            state.next_poll_us += config->report_interval_us;
+        }
+
+        struct scroll_engine *engine = &state.engines[sample->axis];
+        /* The first sample of an axis only sets its reference, its interval is unused */
+        uint32_t dt_us = sample->time_us - state.prev_time_us[sample->axis];
+        uint32_t suppressed = engine->filter.suppressed;
+
+        state.prev_time_us[sample->axis] = sample->time_us;
+
+        /* The pipeline of scroll_process_position */
+        bool has_prev = engine->has_prev;
+        struct scroll_engine_sample changes;
+        int16_t steps = scroll_engine_process(engine, sample->angle, dt_us, config->divider, &changes);
+
+        /* Wheel speed over windows of samples, long enough to average out the count quantization */
+        if (has_prev && sample->axis == 0)
+        {
+            state.window_counts += changes.raw;
+            if (++state.window_samples == RIPPLE_WINDOW)
+            {
+                metrics->window_sum += state.window_counts;
+                metrics->window_square_sum += (uint64_t)((int64_t)state.window_counts * state.window_counts);
+                metrics->windows++;
+                state.window_counts = 0;
+                state.window_samples = 0;
+            }
+        }
+
+        metrics->samples++;
+        metrics->counts[sample->axis] += changes.raw;
+        metrics->steps[sample->axis] += steps;
+        metrics->suppressed += engine->filter.suppressed - suppressed;
+        state.pending[sample->axis] += steps;
+    }
+
+    /* Drain what is left, one poll at a time */
+    while (state.pending[0] || state.pending[1])
+    {
+        poll(&state, report, user_data, metrics);
+        state.next_poll_us += config->report_interval_us;
+    }
+
+    metrics->duration_us = prev_us - start_us;
+    for (int axis = 0; axis < SCROLL_REPLAY_AXES; axis++)
+    {
+        metrics->clamped += state.engines[axis].clamped;
+        metrics->predicted += state.engines[axis].predict.predicted;
+        metrics->lead[axis] = state.engines[axis].predict.lead;
+        metrics->error_counts[axis] = metrics->steps[axis] * config->divider - metrics->counts[axis];
+    }
+
+    return 0;
+}
+
+/* Sine of a position over a revolution in Q8, parabolic approximation */
+static int32_t sine_q8(int32_t position)
+{
+    int32_t half = SCROLL_ENGINE_COUNTS / 2;
+    int32_t x = position & (SCROLL_ENGINE_COUNTS - 1);
+    int32_t sign = x < half ? 1 : -1;
+
+    x %= half;
+
+    return sign * (int32_t)((int64_t)4 * 256 * x * (half - x) / ((int64_t)half * half));
+}
+
+/* Velocity of a gesture at a time, counts per second, and the axis it moves */
+static int32_t gesture_velocity(enum replay_gesture gesture, uint32_t t_us, int32_t prev_velocity, uint32_t period_us,
+                                uint8_t *axis)
+{
+    *axis = 0;
+
+    switch (gesture)
+    {
+    case REPLAY_GESTURE_SLOW:
+        return 400;
+    case REPLAY_GESTURE_SPIN:
+        return 4 * SCROLL_ENGINE_COUNTS;
+    case REPLAY_GESTURE_FLICK:
+        /* 100 ms spin up, then decaying with a 150 ms time constant */
+        if (t_us < 100000)
+        {
+            return (int32_t)((int64_t)40000 * t_us / 100000);
+        }
+        return prev_velocity - (int32_t)((int64_t)prev_velocity * period_us / 150000);
+    case REPLAY_GESTURE_PAN:
+        *axis = 1;
+        return (t_us / 250000) % 2 ? -2000 : 2000;
+    case REPLAY_GESTURE_WOBBLE:
+        return 6144;
+    default:
+        return 0;
+    }
+}
+
+size_t scroll_replay_synthesize(enum replay_gesture gesture, uint32_t period_us, struct replay_sample *samples,
+                                size_t max)
+{
+    /* Position in Q8 counts, starting mid range */
+    int64_t position_q8 = (int64_t)(SCROLL_ENGINE_COUNTS / 2) << 8;
+    int32_t velocity = 0;
+    uint32_t noise = 1;
+    size_t count = 0;
+
+    if (gesture >= REPLAY_GESTURE_COUNT || !period_us)
+    {
+        return 0;
+    }
+
+    for (uint32_t t_us = 0; t_us < GESTURE_US && count < max; t_us += period_us)
+    {
+        uint8_t axis;
+        int32_t angle;
+
+        velocity = gesture_velocity(gesture, t_us, velocity, period_us, &axis);
+        position_q8 += ((int64_t)velocity * period_us << 8) / 1000000;
+        angle = (int32_t)(position_q8 >> 8);
+
+        if (gesture == REPLAY_GESTURE_WOBBLE)
+        {
+            /* Off axis magnet, 24 counts once per revolution and 6 counts twice per revolution */
+            angle += (24 * sine_q8(angle) + 6 * sine_q8(2 * angle + SCROLL_ENGINE_COUNTS / 8)) / 256;
+        }
+        else if (gesture == REPLAY_GESTURE_JITTER)
+        {
+            /* Sensor noise of a wheel at rest, -1, 0 or +1 count */
+            noise = noise * 1103515245 + 12345;
+            angle += (int32_t)((noise >> 16) % 3) - 1;
+        }
+
+        samples[count++] = (struct replay_sample){
+            .time_us = t_us,
+            .axis = axis,
+            .angle = (uint16_t)(angle & (SCROLL_ENGINE_COUNTS - 1)),
+        };
+    }
+
+    return count;
+}
+
+const char *scroll_replay_gesture_name(enum replay_gesture gesture)
+{
+    return gesture < REPLAY_GESTURE_COUNT ? gesture_names[gesture] : NULL;
+}
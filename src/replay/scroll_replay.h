@@ -0,0 +1,152 @@
+#ifndef SCROLL_REPLAY_H
+#define SCROLL_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scroller_linearize.h"
+#include "scroller_scroll_engine.h"
+
+/* Axes carried by a trace, vertical wheel then horizontal pan */
+#define SCROLL_REPLAY_AXES 2
+
+/* One recorded sensor position */
+struct replay_sample
+{
+    /* Time of the sample, increasing */
+    uint32_t time_us;
+    /* 0 for the wheel, 1 for pan */
+    uint8_t axis;
+    /* Raw sensor position, 0 to SCROLL_ENGINE_COUNTS - 1 */
+    uint16_t angle;
+};
+
+/* Pipeline settings, the firmware tuning the trace is replayed with */
+struct replay_config
+{
+    /* Magnet misalignment correction per axis, NULL for none */
+    const struct linearize_table *linearize[SCROLL_REPLAY_AXES];
+    /* Acceleration curve, NULL for none */
+    const struct scroll_accel_curve *accel;
+    /* Position change per emitted step */
+    int32_t divider;
+    /* Rest filter deadband in counts, 0 disables the filter */
+    int32_t deadband;
+    /* Host polling interval. Steps between polls coalesce into one report */
+    uint32_t report_interval_us;
+    /* Latency compensation lead time, 0 for plain reporting, and the estimator settings */
+    uint32_t predict_lead_us;
+    int32_t predict_alpha_q8;
+    int32_t predict_beta_q8;
+    int32_t predict_max_lead;
+};
+
+/* Replay outcome */
+struct replay_metrics
+{
+    uint32_t samples;
+    uint32_t reports;
+    /* Time from the first to the last sample */
+    uint32_t duration_us;
+    /* Wrap corrected position change per axis, the ideal distance */
+    int64_t counts[SCROLL_REPLAY_AXES];
+    /* Steps reported per axis */
+    int64_t steps[SCROLL_REPLAY_AXES];
+    /* Reported distance in counts minus the ideal distance. With acceleration this is
+     * mostly the gain, without it only what is still held in the pipeline or the lead
+     */
+    int64_t error_counts[SCROLL_REPLAY_AXES];
+    /* Sum and sum of squares of the wheel distance over windows of 16 samples, their
+     * spread is the speed ripple of a steady turn
+     */
+    int64_t window_sum;
+    uint64_t window_square_sum;
+    uint32_t windows;
+    /* Samples the rest filter swallowed */
+    uint32_t suppressed;
+    /* Steps the engine truncated to int16, lost */
+    uint32_t clamped;
+    /* Reports that hit the int16 limit and carried the rest to the next poll */
+    uint32_t carried;
+    /* Largest step count in one report */
+    uint32_t max_report_steps;
+    /* Samples the prediction emitted ahead of, and the lead left unpaid at the end per axis */
+    uint32_t predicted;
+    int32_t lead[SCROLL_REPLAY_AXES];
+    /* Wheel reports against the time the wheel reached the reported distance, negative when
+     * the report runs ahead of the wheel. Only measured without acceleration, where steps
+     * map straight to counts, and for wheel motion in one direction.
+     */
+    uint32_t lag_reports;
+    int64_t lag_total_us;
+    int32_t lag_min_us;
+    int32_t lag_max_us;
+};
+
+/* Synthetic gestures */
+enum replay_gesture
+{
+    /* Wheel at rest, +-1 count sensor noise */
+    REPLAY_GESTURE_JITTER,
+    /* Slow steady turn */
+    REPLAY_GESTURE_SLOW,
+    /* Fast steady spin, several revolutions */
+    REPLAY_GESTURE_SPIN,
+    /* Hard flick, spinning up then coasting to a stop */
+    REPLAY_GESTURE_FLICK,
+    /* Back and forth reversals on the pan axis */
+    REPLAY_GESTURE_PAN,
+    /* Steady turn read through an off axis magnet, the error repeats every revolution */
+    REPLAY_GESTURE_WOBBLE,
+    REPLAY_GESTURE_COUNT
+};
+
+/**
+ * @brief Called for every report the replay emits.
+ *
+ * @param user_data Caller context
+ * @param time_us   Poll time of the report
+ * @param steps     Steps per axis
+ */
+typedef void (*replay_report_cb)(void *user_data, uint32_t time_us, const int16_t steps[SCROLL_REPLAY_AXES]);
+
+/**
+ * @brief Run samples through the scroll engine exactly as the firmware does.
+ *
+ * Every sample goes through scroll_engine_process(), like scroll_process_position. The steps
+ * collect per axis until the next host poll, where they are reported clamped to int16
+ * with the rest carried over, like the step accumulator does. Polls continue past the last sample
+ * until nothing is pending.
+ *
+ * @param config    Pipeline settings
+ * @param samples   Samples in time order
+ * @param count     Number of samples
+ * @param report    Report callback, may be NULL
+ * @param user_data Passed to the report callback
+ * @param metrics   Filled with the outcome
+ * @return 0 on success, -1 on an invalid config or a sample out of order
+ */
+int scroll_replay_run(const struct replay_config *config, const struct replay_sample *samples, size_t count,
+                      replay_report_cb report, void *user_data, struct replay_metrics *metrics);
+
+/**
+ * @brief Generate a synthetic gesture.
+ *
+ * @param gesture   Gesture to generate
+ * @param period_us Sample period
+ * @param samples   Buffer for the samples
+ * @param max       Buffer size in samples
+ * @return Number of samples generated, at most max
+ */
+size_t scroll_replay_synthesize(enum replay_gesture gesture, uint32_t period_us, struct replay_sample *samples,
+                                size_t max);
+
+/**
+ * @brief Name of a synthetic gesture.
+ *
+ * @param gesture Gesture
+ * @return Name, NULL for an unknown gesture
+ */
+const char *scroll_replay_gesture_name(enum replay_gesture gesture);
+
+#endif /* SCROLL_REPLAY_H */
@@ -0,0 +1,103 @@
+#define MODULE scroller_replay
+#include <caf/events/module_state_event.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_INF);
+
+#include "scroll_replay.h"
+#include "scroller_config.h"
+
+#ifndef CONFIG_SCROLLER_ACCEL_NONE
+#include "scroller_accel_lut.h"
+
+static const struct scroll_accel_curve accel_curve = {
+    .gain_q8 = scroller_accel_lut,
+    .count = ARRAY_SIZE(scroller_accel_lut),
+    .velocity_step = SCROLLER_ACCEL_LUT_VELOCITY_STEP,
+};
+#endif
+
+#define REPLAY_PERIOD_US (SCROLLER_SAMPLE_PERIOD_DEFAULT_MS * USEC_PER_MSEC)
+
+/* One second of samples, the length of each synthetic gesture */
+static struct replay_sample samples[USEC_PER_SEC / REPLAY_PERIOD_US + 1];
+
+/* Replay every synthetic gesture with the built in tuning and log the outcome */
+static void replay_gestures(void)
+{
+    struct scroller_config_t defaults = SCROLLER_CONFIG_DEFAULTS;
+    struct replay_config config = {
+        .accel = NULL,
+        .divider = defaults.internal_divider,
+        .deadband = defaults.tuning.filter_deadband,
+        .report_interval_us = DT_PROP(SCROLLER_HID_NODE, in_polling_period_us),
+    };
+
+#ifndef CONFIG_SCROLLER_ACCEL_NONE
+    config.accel = &accel_curve;
+#endif
+#ifdef CONFIG_SCROLLER_PREDICT
+    config.predict_lead_us = CONFIG_SCROLLER_PREDICT_LEAD_US;
+    config.predict_alpha_q8 = CONFIG_SCROLLER_PREDICT_ALPHA_Q8;
+    config.predict_beta_q8 = CONFIG_SCROLLER_PREDICT_BETA_Q8;
+    config.predict_max_lead = CONFIG_SCROLLER_PREDICT_MAX_LEAD;
+#endif
+
+    for (int gesture = 0; gesture < REPLAY_GESTURE_COUNT; gesture++)
+    {
+        struct replay_metrics metrics;
+        size_t count = scroll_replay_synthesize(gesture, REPLAY_PERIOD_US, samples, ARRAY_SIZE(samples));
+        uint32_t start = k_cycle_get_32();
+        int err = scroll_replay_run(&config, samples, count, NULL, NULL, &metrics);
+        uint32_t cycles = k_cycle_get_32() - start;
+
+        if (err)
+        {
+            LOG_ERR("Replay %s failed", scroll_replay_gesture_name(gesture));
+            continue;
+        }
+
+        LOG_INF("Replay %s: samples: %u, reports: %u, error (counts) wheel: %lld, pan: %lld, "
+                "suppressed: %u, clamped: %u, carried: %u",
+                scroll_replay_gesture_name(gesture), metrics.samples, metrics.reports, metrics.error_counts[0],
+                metrics.error_counts[1], metrics.suppressed, metrics.clamped, metrics.carried);
+
+        /* Simulated time doesn't advance while code runs on native_sim, the cost always reads 0
+         * there. tools/replay measures it with the host clock.
+         */
+        if (!IS_ENABLED(CONFIG_ARCH_POSIX))
+        {
+            LOG_INF("Replay %s: cycles per sample: %u", scroll_replay_gesture_name(gesture),
+                    metrics.samples ? cycles / metrics.samples : 0);
+        }
+
+        if (metrics.lag_reports)
+        {
+            LOG_INF("Replay %s: distance lag (us) min: %d, avg: %d, max: %d, lead left: %d counts",
+                    scroll_replay_gesture_name(gesture), metrics.lag_min_us,
+                    (int32_t)(metrics.lag_total_us / metrics.lag_reports), metrics.lag_max_us, metrics.lead[0]);
+        }
+    }
+}
+
+/* Event handler for incoming events */
+static bool app_event_handler(const struct app_event_header *aeh)
+{
+    if (is_module_state_event(aeh))
+    {
+        struct module_state_event *event = cast_module_state_event(aeh);
+
+        /* Run once, after the main module has published the config */
+        if (check_state(event, MODULE_ID(main), MODULE_STATE_READY))
+        {
+            replay_gestures();
+        }
+    }
+
+    /* Don't consume the event */
+    return false;
+}
+APP_EVENT_LISTENER(MODULE, app_event_handler);
+/* Listen for modules changing state */
+APP_EVENT_SUBSCRIBE(MODULE, module_state_event);
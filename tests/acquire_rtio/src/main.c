@@ -0,0 +1,257 @@
+/* RTIO acquisition against the emulated AS5600. Positions arrive at the sampling period.
+ * Failed, timed out and stalled reads go through the retries, the bus recovery and the
+ * resync, and the next good angle carries the change made in the meantime.
+ */
+#include <app_event_manager.h>
+#define MODULE main
+#include <caf/events/module_state_event.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/ztest.h>
+
+#include "as5600_emul.h"
+#include "scroller_acquire.h"
+#include "scroller_config.h"
+#include "scroller_scroll_calculate.h"
+
+#define PERIOD_MS CONFIG_SCROLLER_ACQUIRE_PERIOD_MS
+/* Attempts per sample before the bus is recovered */
+#define ATTEMPTS (CONFIG_SCROLLER_I2C_RETRIES + 1)
+/* Wheel angle every test starts from */
+#define START_ANGLE 1000
+
+static const struct emul *wheel = EMUL_DT_GET(DT_NODELABEL(as5600));
+
+/* Stands in for the scroll calculation, wrap corrected position changes of the wheel */
+static struct
+{
+    int32_t prev;
+    bool has_prev;
+    /* Positions, changes since the start of the test and the samples carrying one */
+    uint32_t samples;
+    int32_t total;
+    uint32_t moves;
+} track;
+
+/* Counters at the start of the test, and the emulator faults served */
+static struct acquire_stats start_stats;
+static uint32_t start_faults;
+
+int16_t scroll_process_position(enum scroll_axis axis, int32_t sensor_steps)
+{
+    int32_t delta = 0;
+
+    if (axis != SCROLL_AXIS_WHEEL)
+    {
+        return 0;
+    }
+
+    if (track.has_prev)
+    {
+        delta = sensor_steps - track.prev;
+        if (delta > AS5600_EMUL_COUNTS / 2)
+        {
+            delta -= AS5600_EMUL_COUNTS;
+        }
+        else if (delta < -AS5600_EMUL_COUNTS / 2)
+        {
+            delta += AS5600_EMUL_COUNTS;
+        }
+    }
+    track.prev = sensor_steps;
+    track.has_prev = true;
+    track.samples++;
+
+    if (delta)
+    {
+        track.total += delta;
+        track.moves++;
+    }
+
+    return delta;
+}
+
+void scroll_resync(enum scroll_axis axis)
+{
+    if (axis == SCROLL_AXIS_WHEEL)
+    {
+        track.has_prev = false;
+    }
+}
+
+void scroller_config_get(struct scroller_config_t *config)
+{
+    *config = (struct scroller_config_t)SCROLLER_CONFIG_DEFAULTS;
+}
+
+/* Counters since the start of the test. The longest stall is kept as is */
+static void stats_since_start(struct acquire_stats *stats)
+{
+    acquire_stats_get(stats);
+
+    stats->samples -= start_stats.samples;
+    stats->i2c_errors -= start_stats.i2c_errors;
+    stats->timeouts -= start_stats.timeouts;
+    stats->retries -= start_stats.retries;
+    stats->recoveries -= start_stats.recoveries;
+    stats->recovery_errors -= start_stats.recovery_errors;
+    stats->dropped -= start_stats.dropped;
+    stats->resyncs -= start_stats.resyncs;
+    stats->overruns -= start_stats.overruns;
+}
+
+static void *setup(void)
+{
+    zassert_ok(app_event_manager_init());
+
+    /* Brings up the acquisition and starts sampling */
+    module_set_state(MODULE_STATE_READY);
+
+    return NULL;
+}
+
+static void before(void *fixture)
+{
+    ARG_UNUSED(fixture);
+
+    as5600_emul_inject_faults(wheel, 0, 0);
+    as5600_emul_inject_delay(wheel, 0, 0);
+    as5600_emul_set_angle(wheel, START_ANGLE);
+
+    /* Reads of the previous test done, the reference taken at the start angle */
+    k_sleep(K_MSEC(10 * PERIOD_MS));
+
+    track.total = 0;
+    track.moves = 0;
+    acquire_stats_get(&start_stats);
+    start_faults = as5600_emul_faults_served(wheel);
+}
+
+/* The fault counts below assume one read per position */
+static void skip_oversampled(void)
+{
+    if (CONFIG_SCROLLER_OVERSAMPLE > 1)
+    {
+        ztest_test_skip();
+    }
+}
+
+ZTEST(acquire_rtio, test_sample_rate_holds_the_period)
+{
+    struct acquire_stats stats;
+    const uint32_t window_ms = 1000;
+    uint32_t samples = track.samples;
+
+    k_sleep(K_MSEC(window_ms));
+    stats_since_start(&stats);
+
+    /* Reads between the ticks don't stretch the period, 1 ms is 1000 positions a second */
+    zassert_within(track.samples - samples, window_ms / PERIOD_MS, 1, "%u positions in %u ms",
+                   track.samples - samples, window_ms);
+    zassert_within(stats.samples, (track.samples - samples) * CONFIG_SCROLLER_OVERSAMPLE, CONFIG_SCROLLER_OVERSAMPLE);
+    zassert_equal(stats.overruns, 0);
+}
+
+ZTEST(acquire_rtio, test_retries_bridge_failed_reads)
+{
+    struct acquire_stats stats;
+
+    skip_oversampled();
+
+    as5600_emul_inject_faults(wheel, CONFIG_SCROLLER_I2C_RETRIES, -EIO);
+    k_sleep(K_MSEC(4 * PERIOD_MS));
+    stats_since_start(&stats);
+
+    zassert_equal(as5600_emul_faults_served(wheel) - start_faults, CONFIG_SCROLLER_I2C_RETRIES);
+    zassert_equal(stats.retries, CONFIG_SCROLLER_I2C_RETRIES);
+    zassert_equal(stats.i2c_errors, CONFIG_SCROLLER_I2C_RETRIES);
+    zassert_equal(stats.recoveries, 0, "a sample read on a retry needs no recovery");
+    zassert_equal(stats.dropped, 0);
+    zassert_equal(stats.timeouts, 0);
+    zassert_true(stats.samples > 0);
+}
+
+ZTEST(acquire_rtio, test_dropped_samples_keep_the_reference)
+{
+    struct acquire_stats stats;
+    const uint32_t failed_samples = 3;
+
+    skip_oversampled();
+
+    /* Every attempt of a few samples fails while the wheel turns */
+    as5600_emul_inject_faults(wheel, failed_samples * ATTEMPTS, -EIO);
+    as5600_emul_set_angle(wheel, START_ANGLE + 300);
+    k_sleep(K_MSEC((failed_samples + 4) * PERIOD_MS));
+    stats_since_start(&stats);
+
+    zassert_equal(as5600_emul_faults_served(wheel) - start_faults, failed_samples * ATTEMPTS);
+    zassert_equal(stats.dropped, failed_samples);
+    zassert_equal(stats.retries, failed_samples * CONFIG_SCROLLER_I2C_RETRIES);
+    zassert_equal(stats.i2c_errors, failed_samples * ATTEMPTS);
+    zassert_equal(stats.recoveries, failed_samples, "one recovery per dropped sample");
+    zassert_equal(stats.recovery_errors, stats.recoveries, "the emulated bus has no recovery");
+    zassert_equal(stats.timeouts, 0);
+    zassert_equal(stats.resyncs, 0, "a short stall is bridged");
+    zassert_true(stats.max_stall_us >= failed_samples * PERIOD_MS * USEC_PER_MSEC, "stall %u us",
+                 stats.max_stall_us);
+
+    /* The first good angle carries the whole change */
+    zassert_equal(track.moves, 1);
+    zassert_equal(track.total, 300);
+}
+
+ZTEST(acquire_rtio, test_stuck_bus_resyncs)
+{
+    struct acquire_stats stats;
+
+    skip_oversampled();
+
+    /* A jump the wrap handling would take as motion, made while the bus is stuck */
+    as5600_emul_inject_faults(wheel, AS5600_EMUL_FAULT_STUCK, -EIO);
+    as5600_emul_set_angle(wheel, START_ANGLE + 1500);
+    k_sleep(K_MSEC(CONFIG_SCROLLER_ACQUIRE_RESYNC_MS + 10 * PERIOD_MS));
+    as5600_emul_inject_faults(wheel, 0, 0);
+    k_sleep(K_MSEC(4 * PERIOD_MS));
+    stats_since_start(&stats);
+
+    zassert_equal(stats.resyncs, 1);
+    zassert_true(stats.dropped >= CONFIG_SCROLLER_ACQUIRE_RESYNC_MS / PERIOD_MS, "dropped %u", stats.dropped);
+    zassert_equal(stats.recoveries, stats.dropped, "every dropped sample recovers the bus");
+    zassert_equal(stats.retries, stats.dropped * CONFIG_SCROLLER_I2C_RETRIES);
+    zassert_equal(stats.timeouts, 0);
+    zassert_true(stats.max_stall_us > CONFIG_SCROLLER_ACQUIRE_RESYNC_MS * USEC_PER_MSEC, "stall %u us",
+                 stats.max_stall_us);
+    zassert_equal(track.total, 0, "the first angle after the stall only sets the reference");
+
+    /* Motion from the new reference comes through exactly */
+    as5600_emul_set_angle(wheel, START_ANGLE + 1540);
+    k_sleep(K_MSEC(4 * PERIOD_MS));
+
+    zassert_equal(track.moves, 1);
+    zassert_equal(track.total, 40);
+}
+
+ZTEST(acquire_rtio, test_timed_out_reads_keep_the_pool)
+{
+    struct acquire_stats stats;
+
+    skip_oversampled();
+
+    /* Every attempt of two samples outlasts the timeout, the bus holds each read until it is done */
+    as5600_emul_inject_delay(wheel, 2 * ATTEMPTS, 2 * CONFIG_SCROLLER_ACQUIRE_READ_TIMEOUT_US);
+    as5600_emul_set_angle(wheel, START_ANGLE - 200);
+    k_sleep(K_MSEC(100));
+    stats_since_start(&stats);
+
+    zassert_true(stats.timeouts > 0);
+    zassert_true(stats.retries > 0);
+    zassert_equal(stats.i2c_errors, stats.timeouts, "every failure is a timeout, no submission ran out of SQEs");
+    zassert_true(stats.dropped > 0);
+    zassert_true(stats.recoveries <= stats.dropped, "a bus still running a read isn't recovered");
+
+    /* Reads complete again once the bus lets go, with the whole change */
+    zassert_equal(track.total, -200);
+}
+
+ZTEST_SUITE(acquire_rtio, NULL, setup, before, NULL, NULL);
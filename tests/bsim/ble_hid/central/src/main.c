@@ -0,0 +1,331 @@
+/* HID over GATT central for the scroller BLE transport. Connects to the first connectable
+ * advertiser, subscribes to the wheel input report and checks every wheel step fed on the
+ * peripheral arrives, once. Disconnects after the steps of the first connection and connects
+ * again, the peripheral has to advertise again for the rest.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <bluetooth/gatt_dm.h>
+#include <bluetooth/services/hogp.h>
+
+#include "bstests.h"
+#include "babblekit/testcase.h"
+
+/* Wheel input report id and the steps the peripheral feeds per connection, see peripheral/src/main.c */
+#define WHEEL_REPORT_ID 1
+#define TEST_CONNECTIONS 2
+#define STEPS_PER_CONNECTION (10 * 5)
+#define EXPECTED_WHEEL_STEPS (TEST_CONNECTIONS * STEPS_PER_CONNECTION)
+
+/* Simulated time after which the test fails */
+#define TEST_TIMEOUT_US (30 * USEC_PER_SEC)
+
+static struct bt_conn *default_conn;
+static struct bt_hogp hogp;
+/* Connections made so far */
+static int connections;
+
+/* Steps received in wheel input reports, written from the notification callback */
+static atomic_t wheel_steps;
+static atomic_t reports;
+
+/* Ends the connection once its steps are in, outside the receive thread */
+static struct k_work disconnect_work;
+/* Scans for the peripheral again once the connection is released */
+static struct k_work scan_work;
+
+static void test_init(void)
+{
+    bst_ticker_set_next_tick_absolute(TEST_TIMEOUT_US);
+    bst_result = In_progress;
+}
+
+static void test_tick(bs_time_t hw_device_time)
+{
+    ARG_UNUSED(hw_device_time);
+
+    if (bst_result != Passed)
+    {
+        TEST_FAIL("%ld of %d wheel steps in %ld reports after %u s", atomic_get(&wheel_steps),
+                  EXPECTED_WHEEL_STEPS, atomic_get(&reports), TEST_TIMEOUT_US / USEC_PER_SEC);
+    }
+}
+
+static uint8_t wheel_report_cb(struct bt_hogp *hogp, struct bt_hogp_rep_info *rep, uint8_t err,
+                               const uint8_t *data)
+{
+    ARG_UNUSED(hogp);
+
+    if (err || data == NULL || bt_hogp_rep_size(rep) < 4)
+    {
+        TEST_FAIL("Bad wheel report, err %u", err);
+        return BT_GATT_ITER_STOP;
+    }
+
+    /* Wheel then pan, little endian, without the report id */
+    int16_t wheel = sys_get_le16(&data[0]);
+    int16_t pan = sys_get_le16(&data[2]);
+    atomic_val_t total = atomic_add(&wheel_steps, wheel) + wheel;
+
+    atomic_inc(&reports);
+
+    if (pan != 0)
+    {
+        TEST_FAIL("Unexpected pan steps: %d", pan);
+    }
+    else if (total > connections * STEPS_PER_CONNECTION)
+    {
+        TEST_FAIL("Received %ld wheel steps, more than the %d fed", total, connections * STEPS_PER_CONNECTION);
+    }
+    else if (total == connections * STEPS_PER_CONNECTION)
+    {
+        if (total == EXPECTED_WHEEL_STEPS)
+        {
+            TEST_PASS("All %d wheel steps received in %ld reports over %d connections", EXPECTED_WHEEL_STEPS,
+                      atomic_get(&reports), TEST_CONNECTIONS);
+        }
+
+        /* The steps of this connection are in, the peripheral checks its statistics once it ends */
+        k_work_submit(&disconnect_work);
+    }
+
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static void hogp_ready_cb(struct bt_hogp *hogp)
+{
+    struct bt_hogp_rep_info *rep = NULL;
+
+    while ((rep = bt_hogp_rep_next(hogp, rep)) != NULL)
+    {
+        if (bt_hogp_rep_type(rep) == BT_HIDS_REPORT_TYPE_INPUT && bt_hogp_rep_id(rep) == WHEEL_REPORT_ID)
+        {
+            int err = bt_hogp_rep_subscribe(hogp, rep, wheel_report_cb);
+
+            if (err)
+            {
+                TEST_FAIL("Subscribe failed: %d", err);
+                return;
+            }
+
+            printk("Subscribed to the wheel input report, connection %d\n", connections);
+            return;
+        }
+    }
+
+    TEST_FAIL("No wheel input report");
+}
+
+static void hogp_prep_error_cb(struct bt_hogp *hogp, int err)
+{
+    ARG_UNUSED(hogp);
+
+    TEST_FAIL("HOGP preparation failed: %d", err);
+}
+
+static const struct bt_hogp_init_params hogp_init_params = {
+    .ready_cb = hogp_ready_cb,
+    .prep_error_cb = hogp_prep_error_cb,
+};
+
+static void discovery_completed_cb(struct bt_gatt_dm *dm, void *context)
+{
+    ARG_UNUSED(context);
+
+    int err = bt_hogp_handles_assign(dm, &hogp);
+
+    if (err)
+    {
+        TEST_FAIL("HOGP handles not assigned: %d", err);
+    }
+
+    bt_gatt_dm_data_release(dm);
+}
+
+static void discovery_service_not_found_cb(struct bt_conn *conn, void *context)
+{
+    ARG_UNUSED(conn);
+    ARG_UNUSED(context);
+
+    TEST_FAIL("HID service not found");
+}
+
+static void discovery_error_found_cb(struct bt_conn *conn, int err, void *context)
+{
+    ARG_UNUSED(conn);
+    ARG_UNUSED(context);
+
+    TEST_FAIL("Discovery failed: %d", err);
+}
+
+static const struct bt_gatt_dm_cb discovery_cb = {
+    .completed = discovery_completed_cb,
+    .service_not_found = discovery_service_not_found_cb,
+    .error_found = discovery_error_found_cb,
+};
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type, struct net_buf_simple *ad)
+{
+    ARG_UNUSED(rssi);
+    ARG_UNUSED(ad);
+
+    if (default_conn || (type != BT_GAP_ADV_TYPE_ADV_IND && type != BT_GAP_ADV_TYPE_ADV_DIRECT_IND))
+    {
+        return;
+    }
+
+    if (bt_le_scan_stop())
+    {
+        return;
+    }
+
+    int err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT, &default_conn);
+
+    if (err)
+    {
+        TEST_FAIL("Create connection failed: %d", err);
+    }
+}
+
+static void disconnect_work_fn(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    int err = bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+
+    if (err)
+    {
+        TEST_FAIL("Disconnect failed: %d", err);
+    }
+}
+
+static void scan_work_fn(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    int err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+
+    if (err)
+    {
+        TEST_FAIL("Scanning failed to start: %d", err);
+    }
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+    if (err)
+    {
+        TEST_FAIL("Connection failed: %u", err);
+        return;
+    }
+
+    connections++;
+
+    /* The HID reports need an encrypted link */
+    err = bt_conn_set_security(conn, BT_SECURITY_L2);
+    if (err)
+    {
+        TEST_FAIL("Set security failed: %d", err);
+    }
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    ARG_UNUSED(conn);
+
+    /* Only ended by the central, after the steps of the connection */
+    if (reason != BT_HCI_ERR_LOCALHOST_TERM_CONN ||
+        atomic_get(&wheel_steps) != connections * STEPS_PER_CONNECTION)
+    {
+        TEST_FAIL("Disconnected: 0x%02x", reason);
+        return;
+    }
+
+    bt_hogp_release(&hogp);
+    bt_conn_unref(default_conn);
+    default_conn = NULL;
+}
+
+/* Connection object released, connect again until every connection is made */
+static void recycled(void)
+{
+    if (connections < TEST_CONNECTIONS && default_conn == NULL)
+    {
+        k_work_submit(&scan_work);
+    }
+}
+
+static void security_changed(struct bt_conn *conn, bt_security_t level, enum bt_security_err err)
+{
+    if (err)
+    {
+        TEST_FAIL("Security failed: level %u, err %d", level, err);
+        return;
+    }
+
+    int dm_err = bt_gatt_dm_start(conn, BT_UUID_HIDS, &discovery_cb, NULL);
+
+    if (dm_err)
+    {
+        TEST_FAIL("Discovery not started: %d", dm_err);
+    }
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+    .connected = connected,
+    .disconnected = disconnected,
+    .recycled = recycled,
+    .security_changed = security_changed,
+};
+
+static void test_central(void)
+{
+    int err;
+
+    TEST_START("central");
+
+    k_work_init(&disconnect_work, disconnect_work_fn);
+    k_work_init(&scan_work, scan_work_fn);
+    bt_hogp_init(&hogp, &hogp_init_params);
+
+    err = bt_enable(NULL);
+    if (err)
+    {
+        TEST_FAIL("Bluetooth init failed: %d", err);
+    }
+
+    err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+    if (err)
+    {
+        TEST_FAIL("Scanning failed to start: %d", err);
+    }
+}
+
+static const struct bst_test_instance test_def[] = {
+    {
+        .test_id = "central",
+        .test_descr = "Connect twice, subscribe to the wheel input report and count the steps",
+        .test_pre_init_f = test_init,
+        .test_tick_f = test_tick,
+        .test_main_f = test_central,
+    },
+    BSTEST_END_MARKER,
+};
+
+static struct bst_test_list *test_central_install(struct bst_test_list *tests)
+{
+    return bst_add_tests(tests, test_def);
+}
+
+bst_test_install_t test_installers[] = {test_central_install, NULL};
+
+int main(void)
+{
+    bst_main();
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+#!/usr/bin/env bash
+# Build the central and peripheral images for the nrf52_bsim board
+set -ue
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set to point to the zephyr root directory}"
+
+app_root="$(cd "$(dirname "${BASH_SOURCE[0]}")/../../.." && pwd)"
+
+source ${ZEPHYR_BASE}/tests/bsim/compile.source
+
+app=tests/bsim/ble_hid/central compile
+app=tests/bsim/ble_hid/peripheral compile
+wait_for_background_jobs
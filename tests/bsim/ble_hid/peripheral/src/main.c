@@ -0,0 +1,169 @@
+/* Scroller BLE transport under test. Starts the module as the application does and feeds a
+ * known number of wheel steps in two halves, including while no central is subscribed yet.
+ * The central disconnects after the first half, the second is fed while it reconnects. The
+ * notification statistics of each connection are checked once it ends.
+ */
+#include <app_event_manager.h>
+#define MODULE main
+#include <caf/events/module_state_event.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "bstests.h"
+#include "babblekit/testcase.h"
+
+#include "scroller_ble.h"
+#include "scroller_step_accumulator.h"
+
+/* Steps fed to the accumulator per connection, the central checks it receives exactly these */
+#define TEST_STEP_PUTS 10
+#define TEST_STEPS_PER_PUT 5
+#define TEST_PUT_INTERVAL K_MSEC(100)
+#define TEST_CONNECTIONS 2
+
+/* Longest a notification may wait for a connection event, the idle interval with its peripheral latency */
+#define TEST_LATENCY_MAX_US \
+    (BT_CONN_INTERVAL_TO_US(CONFIG_SCROLLER_BLE_IDLE_INTERVAL) * (CONFIG_SCROLLER_BLE_IDLE_LATENCY + 1))
+/* Once the active interval is in use a notification goes out within two connection events */
+#define TEST_LATENCY_MIN_US (2 * BT_CONN_INTERVAL_TO_US(CONFIG_SCROLLER_BLE_ACTIVE_INTERVAL))
+
+/* Simulated time after which the test fails */
+#define TEST_TIMEOUT_US (30 * USEC_PER_SEC)
+
+static void test_init(void)
+{
+    bst_ticker_set_next_tick_absolute(TEST_TIMEOUT_US);
+    bst_result = In_progress;
+}
+
+static void test_tick(bs_time_t hw_device_time)
+{
+    ARG_UNUSED(hw_device_time);
+
+    if (bst_result != Passed)
+    {
+        TEST_FAIL("Not passed after %u s", TEST_TIMEOUT_US / USEC_PER_SEC);
+    }
+}
+
+static K_SEM_DEFINE(connected_sem, 0, 1);
+static K_SEM_DEFINE(disconnected_sem, 0, 1);
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+    ARG_UNUSED(conn);
+
+    if (!err)
+    {
+        k_sem_give(&connected_sem);
+    }
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+    ARG_UNUSED(conn);
+    ARG_UNUSED(reason);
+
+    k_sem_give(&disconnected_sem);
+}
+
+BT_CONN_CB_DEFINE(test_conn_callbacks) = {
+    .connected = connected,
+    .disconnected = disconnected,
+};
+
+/* At most one notification per connection event, each sent within the bounds */
+static void check_notify_stats(int connection)
+{
+    struct ble_notify_stats stats;
+
+    ble_notify_stats_get(&stats);
+
+    printk("Connection %d: %u notifications in %u connection events, latency (us) min %u avg %u max %u\n",
+           connection, stats.reports, stats.events, stats.latency_min_us, stats.latency_avg_us,
+           stats.latency_max_us);
+
+    if (stats.reports == 0)
+    {
+        TEST_FAIL("Connection %d sent no notifications", connection);
+    }
+    else if (stats.reports > stats.events)
+    {
+        TEST_FAIL("Connection %d sent %u notifications in %u connection events", connection, stats.reports,
+                  stats.events);
+    }
+    else if (stats.latency_max_us > TEST_LATENCY_MAX_US)
+    {
+        TEST_FAIL("Connection %d notification latency %u us, over %u us", connection, stats.latency_max_us,
+                  TEST_LATENCY_MAX_US);
+    }
+    else if (stats.latency_min_us > TEST_LATENCY_MIN_US)
+    {
+        TEST_FAIL("Connection %d never sent within %u us, min latency %u us", connection, TEST_LATENCY_MIN_US,
+                  stats.latency_min_us);
+    }
+}
+
+static void test_peripheral(void)
+{
+    TEST_START("peripheral");
+
+    if (app_event_manager_init())
+    {
+        TEST_FAIL("Application event manager failed to init");
+    }
+
+    /* Brings up the BLE module and starts advertising */
+    module_set_state(MODULE_STATE_READY);
+
+    for (int connection = 1; connection <= TEST_CONNECTIONS; connection++)
+    {
+        /* Steps made before the central connects and subscribes are kept until it does. The
+         * second half is fed while the central reconnects, to advertising restarted after the
+         * first connection.
+         */
+        for (int i = 0; i < TEST_STEP_PUTS; i++)
+        {
+            step_accumulator_put(SCROLL_AXIS_WHEEL, TEST_STEPS_PER_PUT);
+            k_sleep(TEST_PUT_INTERVAL);
+        }
+
+        /* The central disconnects once it received the steps of the connection */
+        if (k_sem_take(&connected_sem, K_SECONDS(5)) || k_sem_take(&disconnected_sem, K_SECONDS(5)))
+        {
+            TEST_FAIL("Connection %d not made and ended", connection);
+            return;
+        }
+
+        check_notify_stats(connection);
+    }
+
+    TEST_PASS("%d wheel steps fed over %d connections", TEST_CONNECTIONS * TEST_STEP_PUTS * TEST_STEPS_PER_PUT,
+              TEST_CONNECTIONS);
+}
+
+static const struct bst_test_instance test_def[] = {
+    {
+        .test_id = "peripheral",
+        .test_descr = "Scroller BLE HID transport fed with wheel steps over two connections",
+        .test_pre_init_f = test_init,
+        .test_tick_f = test_tick,
+        .test_main_f = test_peripheral,
+    },
+    BSTEST_END_MARKER,
+};
+
+static struct bst_test_list *test_peripheral_install(struct bst_test_list *tests)
+{
+    return bst_add_tests(tests, test_def);
+}
+
+bst_test_install_t test_installers[] = {test_peripheral_install, NULL};
+
+int main(void)
+{
+    bst_main();
+
+    return 0;
+}
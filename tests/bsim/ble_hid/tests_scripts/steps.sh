@@ -0,0 +1,21 @@
+#!/usr/bin/env bash
+# A HID over GATT central connects to the scroller, subscribes to the wheel input report and
+# receives every wheel step fed to the peripheral's step accumulator. It disconnects halfway
+# and connects again to the advertising the scroller restarts
+source ${ZEPHYR_BASE}/tests/bsim/sh_common.source
+
+simulation_id="scroller_ble_hid_steps"
+verbosity_level=2
+EXECUTE_TIMEOUT=60
+
+cd ${BSIM_OUT_PATH}/bin
+
+Execute ./bs_${BOARD_TS}_tests_bsim_ble_hid_central_prj_conf \
+  -v=${verbosity_level} -s=${simulation_id} -d=0 -testid=central
+
+Execute ./bs_${BOARD_TS}_tests_bsim_ble_hid_peripheral_prj_conf \
+  -v=${verbosity_level} -s=${simulation_id} -d=1 -testid=peripheral
+
+Execute ./bs_2G4_phy_v1 -v=${verbosity_level} -s=${simulation_id} -D=2 -sim_length=30e6 $@
+
+wait_for_background_jobs
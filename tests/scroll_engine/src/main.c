@@ -0,0 +1,420 @@
+/* Properties and per call cost of the scroll engine stages, and the calibration recording.
+ *
+ * Runs the firmware engine sources unchanged, on the host with the unit_testing board and
+ * on hardware where the timing functions count CPU cycles.
+ */
+#include <errno.h>
+#include <zephyr/ztest.h>
+
+#ifdef ZTEST_UNITTEST
+#include <time.h>
+#else
+#include <zephyr/timing/timing.h>
+#endif
+
+#include "scroller_scroll_engine.h"
+#include "scroller_linearize.h"
+#include "scroller_accel_profiles.h"
+
+/* Firmware default of CONFIG_SCROLLER_FILTER_DEADBAND */
+#define DEFAULT_DEADBAND 2
+
+/* Samples run through the pipeline for the benchmark */
+#define BENCHMARK_SAMPLES 100000
+/* Generous per call bound, a regression by an order of magnitude still fails */
+#define BENCHMARK_MAX_NS 20000
+
+static struct scroll_engine engine;
+
+/* Deterministic pseudo random sequence, same on every platform */
+static uint32_t lcg_state;
+
+static int32_t lcg_range(int32_t min, int32_t max)
+{
+    lcg_state = lcg_state * 1664525U + 1013904223U;
+
+    return min + (int32_t)((lcg_state >> 8) % (uint32_t)(max - min + 1));
+}
+
+static void before(void *fixture)
+{
+    ARG_UNUSED(fixture);
+
+    scroll_engine_init(&engine);
+    lcg_state = 1;
+}
+
+ZTEST(scroll_engine, test_delta_first_position_sets_reference)
+{
+    zassert_equal(scroll_engine_delta(&engine, 1234), 0);
+    zassert_equal(scroll_engine_delta(&engine, 1240), 6);
+}
+
+ZTEST(scroll_engine, test_delta_wraps_at_zero)
+{
+    scroll_engine_delta(&engine, 4095);
+    zassert_equal(scroll_engine_delta(&engine, 0), 1, "4095 to 0 is one count forward");
+    zassert_equal(scroll_engine_delta(&engine, 4095), -1, "0 to 4095 is one count back");
+    zassert_equal(scroll_engine_delta(&engine, 100), 101);
+    zassert_equal(scroll_engine_delta(&engine, 4000), -196);
+}
+
+ZTEST(scroll_engine, test_delta_resolves_every_change_below_half_a_revolution)
+{
+    for (int32_t start = 0; start < SCROLL_ENGINE_COUNTS; start += 97)
+    {
+        for (int32_t change = -(SCROLL_ENGINE_COUNTS / 2 - 1); change < SCROLL_ENGINE_COUNTS / 2; change += 13)
+        {
+            int32_t end = (start + change + SCROLL_ENGINE_COUNTS) % SCROLL_ENGINE_COUNTS;
+
+            scroll_engine_init(&engine);
+            scroll_engine_delta(&engine, start);
+            zassert_equal(scroll_engine_delta(&engine, end), change, "%d to %d", start, end);
+        }
+    }
+}
+
+ZTEST(scroll_engine, test_filter_disabled_passes_through)
+{
+    engine.filter.deadband = 0;
+
+    for (int i = 0; i < 100; i++)
+    {
+        int16_t delta = (int16_t)lcg_range(-50, 50);
+
+        zassert_equal(scroll_engine_filter(&engine, delta, 1000), delta);
+    }
+}
+
+ZTEST(scroll_engine, test_filter_holds_rest_jitter)
+{
+    engine.filter.deadband = 2;
+
+    /* Moving forward passes once past the deadband, then without delay */
+    zassert_equal(scroll_engine_filter(&engine, 3, 1000), 3);
+    zassert_equal(scroll_engine_filter(&engine, 1, 1000), 1);
+
+    /* A wheel jittering by a count at rest emits nothing */
+    for (int i = 0; i < 100; i++)
+    {
+        zassert_equal(scroll_engine_filter(&engine, (i & 1) ? 1 : -1, 1000), 0, "sample %d", i);
+    }
+    zassert_equal(engine.filter.suppressed, 100);
+
+    /* A reversal past the deadband passes in full */
+    zassert_equal(scroll_engine_filter(&engine, -3, 1000), -3);
+    zassert_equal(scroll_engine_filter(&engine, -1, 1000), -1);
+}
+
+ZTEST(scroll_engine, test_filter_holds_three_level_jitter_at_default)
+{
+    int32_t position = 2000;
+
+    engine.filter.deadband = DEFAULT_DEADBAND;
+    scroll_engine_delta(&engine, position);
+
+    /* Moving forward, then settling at rest */
+    for (int i = 0; i < 10; i++)
+    {
+        position += 5;
+        scroll_engine_filter(&engine, scroll_engine_delta(&engine, position), 1000);
+    }
+
+    /* Sensor noise of -1, 0 or +1 count around the rest position, changes of up to 2. Only
+     * the first count still in the direction of motion may pass, it can't be told apart
+     */
+    int emitted = 0;
+    int changes = 0;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        int16_t delta = scroll_engine_delta(&engine, position + lcg_range(-1, 1));
+        int16_t out = scroll_engine_filter(&engine, delta, 1000);
+
+        emitted += out < 0 ? -out : out;
+        changes += out ? 1 : 0;
+    }
+    zassert_true(emitted <= 1 && changes <= 1, "%d counts in %d changes", emitted, changes);
+}
+
+ZTEST(scroll_engine, test_filter_conserves_distance)
+{
+    int32_t in = 0;
+    int32_t out = 0;
+
+    engine.filter.deadband = 3;
+
+    for (int i = 0; i < 10000; i++)
+    {
+        int16_t delta = (int16_t)lcg_range(-6, 6);
+
+        in += delta;
+        out += scroll_engine_filter(&engine, delta, 1000);
+    }
+
+    /* Whatever is held back is still in the residual */
+    zassert_equal(out + engine.filter.residual, in);
+}
+
+ZTEST(scroll_engine, test_accel_tables_monotonic)
+{
+    for (size_t p = 0; p < ARRAY_SIZE(scroller_accel_profiles); p++)
+    {
+        const uint16_t *gain_q8 = scroller_accel_profiles[p].gain_q8;
+
+        zassert_equal(gain_q8[0], 256, "%s starts at unity gain", scroller_accel_profiles[p].name);
+        for (int i = 1; i < SCROLLER_ACCEL_LUT_ENTRIES; i++)
+        {
+            zassert_true(gain_q8[i] >= gain_q8[i - 1], "%s entry %d", scroller_accel_profiles[p].name, i);
+        }
+    }
+}
+
+ZTEST(scroll_engine, test_accel_output_monotonic_in_velocity)
+{
+    for (size_t p = 0; p < ARRAY_SIZE(scroller_accel_profiles); p++)
+    {
+        const struct scroll_accel_curve curve = {
+            .gain_q8 = scroller_accel_profiles[p].gain_q8,
+            .count = SCROLLER_ACCEL_LUT_ENTRIES,
+            .velocity_step = SCROLLER_ACCEL_LUT_VELOCITY_STEP,
+        };
+        int32_t prev = 0;
+
+        /* Past the end of the table as well, every change over the same 5 ms */
+        for (int16_t delta = 1; delta < 2048; delta++)
+        {
+            scroll_engine_init(&engine);
+            engine.accel = &curve;
+
+            int32_t accelerated = scroll_engine_accelerate(&engine, delta, 5000);
+
+            zassert_true(accelerated >= prev, "%s at %d counts", scroller_accel_profiles[p].name, delta);
+            zassert_true(accelerated >= delta, "gain below unity at %d counts", delta);
+            prev = accelerated;
+        }
+    }
+}
+
+ZTEST(scroll_engine, test_scale_conserves_remainder)
+{
+    static const int32_t dividers[] = {1, 7, 34, 120};
+
+    for (size_t d = 0; d < ARRAY_SIZE(dividers); d++)
+    {
+        int64_t deltas = 0;
+        int64_t steps = 0;
+
+        scroll_engine_init(&engine);
+
+        for (int i = 0; i < 10000; i++)
+        {
+            int32_t delta = lcg_range(-300, 300);
+
+            deltas += delta;
+            steps += scroll_engine_scale(&engine, delta, dividers[d]);
+        }
+
+        zassert_equal(steps * dividers[d] + engine.accumulator, deltas, "divider %d", dividers[d]);
+        zassert_true(engine.accumulator > -dividers[d] && engine.accumulator < dividers[d]);
+        zassert_equal(engine.clamped, 0);
+    }
+}
+
+ZTEST(scroll_engine, test_scale_counts_clamped_steps)
+{
+    zassert_equal(scroll_engine_scale(&engine, 40000, 1), INT16_MAX);
+    zassert_equal(engine.clamped, 40000 - INT16_MAX);
+
+    zassert_equal(scroll_engine_scale(&engine, -40000, 1), INT16_MIN);
+    zassert_equal(engine.clamped, (40000 - INT16_MAX) + (40000 + INT16_MIN));
+
+    /* In range changes don't count */
+    zassert_equal(scroll_engine_scale(&engine, 100, 1), 100);
+    zassert_equal(engine.clamped, (40000 - INT16_MAX) + (40000 + INT16_MIN));
+}
+
+ZTEST(scroll_engine, test_predict_pays_back_lead_gradually)
+{
+    int32_t in = 0;
+    int32_t out = 0;
+
+    engine.predict.lead_us = 3000;
+    engine.predict.alpha_q8 = 128;
+    engine.predict.beta_q8 = 43;
+    engine.predict.max_lead = 64;
+
+    /* Fast spin that stops hard, leaving the lead ahead of the wheel */
+    for (int i = 0; i < 50; i++)
+    {
+        in += 40;
+        out += scroll_engine_predict(&engine, 40, 1000);
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        out += scroll_engine_predict(&engine, 0, 1000);
+    }
+    zassert_true(engine.predict.lead > 1, "stopped with a lead of %d", engine.predict.lead);
+
+    /* Slow reversal, the lead comes back at most a change's worth per sample */
+    for (int i = 0; i < 200; i++)
+    {
+        int32_t emitted = scroll_engine_predict(&engine, -1, 1000);
+
+        zassert_true(emitted >= -2 && emitted <= 0, "sample %d emitted %d", i, emitted);
+        in -= 1;
+        out += emitted;
+    }
+
+    /* Nothing lost, whatever is still ahead is the lead */
+    zassert_equal(out - engine.predict.lead, in);
+}
+
+ZTEST(scroll_engine, test_process_runs_every_stage)
+{
+    struct linearize_table table = {0};
+    struct scroll_engine staged;
+    int32_t position = 0;
+
+    /* A correction that grows over the revolution, so the deltas differ from the raw ones */
+    for (int i = 0; i < LINEARIZE_POINTS; i++)
+    {
+        table.correction_q4[i] = (int16_t)(i * 8);
+    }
+
+    engine.linearize = &table;
+    engine.filter.deadband = 2;
+    staged = engine;
+
+    for (int i = 0; i < 10000; i++)
+    {
+        struct scroll_engine_sample sample;
+
+        position = (position + lcg_range(-20, 40)) & (SCROLL_ENGINE_COUNTS - 1);
+
+        int16_t raw = scroll_engine_delta(&staged, linearize_apply(&table, position));
+        int16_t delta = scroll_engine_filter(&staged, raw, 1000);
+        int16_t steps = scroll_engine_scale(
+            &staged, scroll_engine_predict(&staged, scroll_engine_accelerate(&staged, delta, 1000), 1000), 7);
+
+        zassert_equal(scroll_engine_process(&engine, position, 1000, 7, &sample), steps, "sample %d", i);
+        zassert_equal(sample.raw, raw);
+        zassert_equal(sample.delta, delta);
+    }
+}
+
+/* Record a spin of a revolution per second for the first revolution, scaled by percent after it */
+static int calibrate_spin(struct linearize_builder *builder, uint32_t rest_us, int32_t second_speed_percent)
+{
+    static struct linearize_table table;
+    uint32_t time_us = 1000;
+    int64_t position_q8 = 100 << 8;
+    bool done = false;
+
+    linearize_builder_start(builder, 2);
+
+    /* At rest with a count of jitter, then spinning */
+    for (; time_us < rest_us; time_us += 1000)
+    {
+        done = linearize_builder_add(builder, 100 + (time_us / 1000) % 2, time_us);
+    }
+    while (!done && time_us < 10000000)
+    {
+        int32_t speed = position_q8 < ((100 + SCROLL_ENGINE_COUNTS) << 8) ? 100 : second_speed_percent;
+
+        position_q8 += (int64_t)SCROLL_ENGINE_COUNTS * 256 * speed / 100 / 1000;
+        time_us += 1000;
+        done = linearize_builder_add(builder, (int32_t)(position_q8 >> 8) & (SCROLL_ENGINE_COUNTS - 1), time_us);
+    }
+
+    zassert_true(done, "the revolutions were recorded");
+
+    return linearize_builder_finish(builder, &table);
+}
+
+ZTEST(scroll_engine, test_calibration_times_from_first_motion)
+{
+    static struct linearize_builder builder;
+
+    /* A long rest before the spin would read as a slow first revolution */
+    zassert_equal(calibrate_spin(&builder, 3000000, 100), 0);
+    zassert_equal(builder.revolution_max_us - builder.revolution_min_us, 0);
+}
+
+ZTEST(scroll_engine, test_calibration_rejects_speed_change)
+{
+    static struct linearize_builder builder;
+
+    zassert_equal(calibrate_spin(&builder, 0, 105), 0, "within the variation");
+    zassert_equal(calibrate_spin(&builder, 0, 130), -EINVAL);
+}
+
+#ifdef ZTEST_UNITTEST
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+#endif
+
+ZTEST(scroll_engine, test_benchmark_pipeline)
+{
+#if defined(CONFIG_ARCH_POSIX) && !defined(ZTEST_UNITTEST)
+    /* Simulated time doesn't advance while code runs on native_sim, the cost would always
+     * read 0 and pass. Measured on the unit_testing host build and on hardware.
+     */
+    ztest_test_skip();
+#endif
+
+    const struct scroll_accel_curve curve = {
+        .gain_q8 = scroller_accel_profiles[0].gain_q8,
+        .count = SCROLLER_ACCEL_LUT_ENTRIES,
+        .velocity_step = SCROLLER_ACCEL_LUT_VELOCITY_STEP,
+    };
+    int32_t position = 0;
+    int32_t total = 0;
+
+    engine.filter.deadband = 1;
+    engine.accel = &curve;
+    engine.predict.lead_us = 3000;
+    engine.predict.alpha_q8 = 128;
+    engine.predict.beta_q8 = 43;
+    engine.predict.max_lead = 64;
+
+#ifdef ZTEST_UNITTEST
+    uint64_t start = now_ns();
+#else
+    timing_init();
+    timing_start();
+    timing_t start = timing_counter_get();
+#endif
+
+    /* Every stage of a sample, from raw position to steps */
+    for (int i = 0; i < BENCHMARK_SAMPLES; i++)
+    {
+        position = (position + lcg_range(-4, 40)) & (SCROLL_ENGINE_COUNTS - 1);
+        total += scroll_engine_process(&engine, position, 1000, 1, NULL);
+    }
+
+#ifdef ZTEST_UNITTEST
+    uint64_t ns = now_ns() - start;
+
+    TC_PRINT("%u ns per sample\n", (uint32_t)(ns / BENCHMARK_SAMPLES));
+#else
+    timing_t end = timing_counter_get();
+    uint64_t cycles = timing_cycles_get(&start, &end);
+    uint64_t ns = timing_cycles_to_ns(cycles);
+
+    timing_stop();
+    TC_PRINT("%u cycles, %u ns per sample\n", (uint32_t)(cycles / BENCHMARK_SAMPLES),
+             (uint32_t)(ns / BENCHMARK_SAMPLES));
+#endif
+
+    zassert_true(total > 0, "the wheel moved forward");
+    zassert_true(ns / BENCHMARK_SAMPLES < BENCHMARK_MAX_NS);
+}
+
+ZTEST_SUITE(scroll_engine, NULL, NULL, before, NULL, NULL);
@@ -0,0 +1,449 @@
+/* Host replay of recorded or synthetic wheel traces through the firmware scroll engine.
+ *
+ * Reads the CSV written by scripts/trace_decode.py, or generates a synthetic gesture,
+ * runs it through the same engine sources the firmware builds, writes the report stream
+ * as CSV and the metrics to stderr.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scroll_replay.h"
+#include "scroller_accel_profiles.h"
+
+/* Firmware defaults, hi-res divider, SCROLLER_TUNING_DEFAULTS and the hid_dev_0 polling period */
+#define DEFAULT_DIVIDER 1
+#define DEFAULT_DEADBAND 2
+#define DEFAULT_POLL_US 2000
+#define DEFAULT_PERIOD_US 5000
+#define DEFAULT_REPEAT 100
+/* Firmware prediction defaults, see CONFIG_SCROLLER_PREDICT_* */
+#define DEFAULT_ALPHA_Q8 128
+#define DEFAULT_BETA_Q8 43
+#define DEFAULT_MAX_LEAD 64
+
+static struct scroll_accel_curve accel_curve = {
+    .count = SCROLLER_ACCEL_LUT_ENTRIES,
+    .velocity_step = SCROLLER_ACCEL_LUT_VELOCITY_STEP,
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] (TRACE.csv | --synthetic GESTURE)\n"
+            "  --divider N      counts per step (%d)\n"
+            "  --deadband N     rest filter deadband in counts, 0 off (%d)\n"
+            "  --accel PROFILE  none, classic, gentle or steep (none)\n"
+            "  --poll-us N      host polling interval (%d)\n"
+            "  --predict-us N   latency compensation lead time, 0 off (0)\n"
+            "  --alpha N        Q8 estimator position gain (%d)\n"
+            "  --beta N         Q8 estimator velocity gain (%d)\n"
+            "  --max-lead N     largest lead in accelerated counts (%d)\n"
+            "  --calibrate N    build a misalignment table from the first N revolutions and apply it\n"
+            "  --period-us N    synthetic sample period (%d)\n"
+            "  --repeat N       timed runs for the per sample cost (%d)\n"
+            "  --reports FILE   report stream CSV, - for stdout (none)\n"
+            "gestures:",
+            name, DEFAULT_DIVIDER, DEFAULT_DEADBAND, DEFAULT_POLL_US, DEFAULT_ALPHA_Q8, DEFAULT_BETA_Q8,
+            DEFAULT_MAX_LEAD, DEFAULT_PERIOD_US, DEFAULT_REPEAT);
+
+    for (int gesture = 0; gesture < REPLAY_GESTURE_COUNT; gesture++)
+    {
+        fprintf(stderr, " %s", scroll_replay_gesture_name(gesture));
+    }
+    fprintf(stderr, "\n");
+}
+
+static int parse_long(const char *text, long min, long *value)
+{
+    char *end;
+
+    errno = 0;
+    *value = strtol(text, &end, 0);
+
+    return errno || *end || end == text || *value < min ? -1 : 0;
+}
+
+static int select_accel(const char *name, const struct scroll_accel_curve **accel)
+{
+    if (!strcmp(name, "none"))
+    {
+        *accel = NULL;
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(scroller_accel_profiles) / sizeof(scroller_accel_profiles[0]); i++)
+    {
+        if (!strcmp(name, scroller_accel_profiles[i].name))
+        {
+            accel_curve.gain_q8 = scroller_accel_profiles[i].gain_q8;
+            *accel = &accel_curve;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Read time_us,axis,angle[,steps] rows, skipping the header */
+static struct replay_sample *load_trace(const char *path, size_t *count)
+{
+    FILE *file = fopen(path, "r");
+    struct replay_sample *samples = NULL;
+    size_t capacity = 0;
+    char line[128];
+
+    if (!file)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    *count = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned long time_us;
+        unsigned int axis;
+        unsigned int angle;
+
+        if (sscanf(line, "%lu,%u,%u", &time_us, &axis, &angle) != 3)
+        {
+            continue;
+        }
+
+        if (*count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            struct replay_sample *grown = realloc(samples, capacity * sizeof(*samples));
+            if (!grown)
+            {
+                free(samples);
+                fclose(file);
+                return NULL;
+            }
+            samples = grown;
+        }
+
+        samples[(*count)++] = (struct replay_sample){
+            .time_us = (uint32_t)time_us,
+            .axis = (uint8_t)axis,
+            .angle = (uint16_t)angle,
+        };
+    }
+
+    fclose(file);
+
+    return samples;
+}
+
+static struct replay_sample *synthesize(const char *name, uint32_t period_us, size_t *count)
+{
+    for (int gesture = 0; gesture < REPLAY_GESTURE_COUNT; gesture++)
+    {
+        if (strcmp(name, scroll_replay_gesture_name(gesture)))
+        {
+            continue;
+        }
+
+        size_t max = 1000000 / period_us + 1;
+        struct replay_sample *samples = malloc(max * sizeof(*samples));
+
+        if (samples)
+        {
+            *count = scroll_replay_synthesize(gesture, period_us, samples, max);
+        }
+        return samples;
+    }
+
+    fprintf(stderr, "unknown gesture: %s\n", name);
+
+    return NULL;
+}
+
+/* Build a correction table per axis from the start of the samples, as the firmware calibration does */
+static int calibrate(const struct replay_sample *samples, size_t count, int32_t revolutions,
+                     struct linearize_table tables[SCROLL_REPLAY_AXES], struct replay_config *config)
+{
+    static struct linearize_builder builder;
+
+    for (int axis = 0; axis < SCROLL_REPLAY_AXES; axis++)
+    {
+        bool done = false;
+        int peak = 0;
+
+        linearize_builder_start(&builder, revolutions);
+        for (size_t i = 0; i < count && !done; i++)
+        {
+            if (samples[i].axis != axis)
+            {
+                continue;
+            }
+            done = linearize_builder_add(&builder, samples[i].angle, samples[i].time_us);
+        }
+
+        if (!builder.started)
+        {
+            continue;
+        }
+
+        int err = done ? linearize_builder_finish(&builder, &tables[axis]) : -ENODATA;
+        if (err)
+        {
+            fprintf(stderr, "axis %d calibration failed: %d\n", axis, err);
+            return err;
+        }
+
+        for (int point = 0; point < LINEARIZE_POINTS; point++)
+        {
+            int magnitude = (abs(tables[axis].correction_q4[point]) + 8) / 16;
+            peak = magnitude > peak ? magnitude : peak;
+        }
+        fprintf(stderr, "axis %d calibrated, peak correction %d counts\n", axis, peak);
+        config->linearize[axis] = &tables[axis];
+    }
+
+    return 0;
+}
+
+static void write_report(void *user_data, uint32_t time_us, const int16_t steps[SCROLL_REPLAY_AXES])
+{
+    fprintf(user_data, "%u,%d,%d\n", time_us, steps[0], steps[1]);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_metrics(const struct replay_config *config, const struct replay_metrics *metrics, double sample_ns)
+{
+    static const char *const axis_names[SCROLL_REPLAY_AXES] = {"wheel", "pan"};
+    double seconds = metrics->duration_us / 1e6;
+
+    fprintf(stderr, "samples: %u over %.3f s\n", metrics->samples, seconds);
+    fprintf(stderr, "reports: %u, %.1f/s, largest %u steps\n", metrics->reports,
+            seconds > 0 ? metrics->reports / seconds : 0.0, metrics->max_report_steps);
+
+    for (int axis = 0; axis < SCROLL_REPLAY_AXES; axis++)
+    {
+        if (!metrics->counts[axis] && !metrics->steps[axis])
+        {
+            continue;
+        }
+
+        fprintf(stderr, "%s: ideal %lld counts, reported %lld steps (%lld counts), error %lld counts", axis_names[axis],
+                (long long)metrics->counts[axis], (long long)metrics->steps[axis],
+                (long long)(metrics->steps[axis] * config->divider), (long long)metrics->error_counts[axis]);
+        if (metrics->counts[axis])
+        {
+            fprintf(stderr, " (%+.2f%%)", 100.0 * metrics->error_counts[axis] / llabs(metrics->counts[axis]));
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (metrics->windows)
+    {
+        double mean = (double)metrics->window_sum / metrics->windows;
+        double variance = (double)metrics->window_square_sum / metrics->windows - mean * mean;
+        double deviation = variance > 0 ? sqrt(variance) : 0.0;
+
+        fprintf(stderr, "wheel speed ripple: %.2f%% (%.2f counts per 16 samples, mean %.2f)\n",
+                mean ? 100.0 * deviation / fabs(mean) : 0.0, deviation, mean);
+    }
+    fprintf(stderr, "suppressed samples: %u, clamped steps: %u, carried reports: %u\n", metrics->suppressed,
+            metrics->clamped, metrics->carried);
+
+    if (config->predict_lead_us)
+    {
+        fprintf(stderr, "predicted samples: %u, lead left wheel: %d, pan: %d counts\n", metrics->predicted,
+                metrics->lead[0], metrics->lead[1]);
+    }
+    if (metrics->lag_reports)
+    {
+        fprintf(stderr, "distance lag (us) min: %d, avg: %lld, max: %d over %u reports\n", metrics->lag_min_us,
+                (long long)(metrics->lag_total_us / metrics->lag_reports), metrics->lag_max_us,
+                metrics->lag_reports);
+    }
+    fprintf(stderr, "cost per sample: %.1f ns\n", sample_ns);
+}
+
+int main(int argc, char **argv)
+{
+    struct replay_config config = {
+        .accel = NULL,
+        .divider = DEFAULT_DIVIDER,
+        .deadband = DEFAULT_DEADBAND,
+        .report_interval_us = DEFAULT_POLL_US,
+        .predict_lead_us = 0,
+        .predict_alpha_q8 = DEFAULT_ALPHA_Q8,
+        .predict_beta_q8 = DEFAULT_BETA_Q8,
+        .predict_max_lead = DEFAULT_MAX_LEAD,
+    };
+    const char *trace = NULL;
+    const char *gesture = NULL;
+    const char *reports = NULL;
+    long period_us = DEFAULT_PERIOD_US;
+    long repeat = DEFAULT_REPEAT;
+    long revolutions = 0;
+    struct linearize_table tables[SCROLL_REPLAY_AXES];
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *next = i + 1 < argc ? argv[i + 1] : NULL;
+        long value;
+        int err = 0;
+
+        if (arg[0] != '-')
+        {
+            trace = arg;
+            continue;
+        }
+
+        if (!next)
+        {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+
+        if (!strcmp(arg, "--divider"))
+        {
+            err = parse_long(next, 1, &value);
+            config.divider = value;
+        }
+        else if (!strcmp(arg, "--deadband"))
+        {
+            err = parse_long(next, 0, &value);
+            config.deadband = value;
+        }
+        else if (!strcmp(arg, "--accel"))
+        {
+            err = select_accel(next, &config.accel);
+        }
+        else if (!strcmp(arg, "--poll-us"))
+        {
+            err = parse_long(next, 1, &value);
+            config.report_interval_us = value;
+        }
+        else if (!strcmp(arg, "--predict-us"))
+        {
+            err = parse_long(next, 0, &value);
+            config.predict_lead_us = value;
+        }
+        else if (!strcmp(arg, "--alpha"))
+        {
+            err = parse_long(next, 1, &value) || value > 256;
+            config.predict_alpha_q8 = value;
+        }
+        else if (!strcmp(arg, "--beta"))
+        {
+            err = parse_long(next, 0, &value) || value > 512;
+            config.predict_beta_q8 = value;
+        }
+        else if (!strcmp(arg, "--max-lead"))
+        {
+            err = parse_long(next, 0, &value);
+            config.predict_max_lead = value;
+        }
+        else if (!strcmp(arg, "--calibrate"))
+        {
+            err = parse_long(next, 1, &revolutions);
+        }
+        else if (!strcmp(arg, "--period-us"))
+        {
+            err = parse_long(next, 1, &period_us);
+        }
+        else if (!strcmp(arg, "--repeat"))
+        {
+            err = parse_long(next, 1, &repeat);
+        }
+        else if (!strcmp(arg, "--reports"))
+        {
+            reports = next;
+        }
+        else if (!strcmp(arg, "--synthetic"))
+        {
+            gesture = next;
+        }
+        else
+        {
+            err = -1;
+        }
+
+        if (err)
+        {
+            fprintf(stderr, "invalid %s: %s\n", arg, next);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!trace == !gesture)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    size_t count = 0;
+    struct replay_sample *samples = trace ? load_trace(trace, &count) : synthesize(gesture, period_us, &count);
+    if (!samples)
+    {
+        return 1;
+    }
+
+    if (revolutions && calibrate(samples, count, revolutions, tables, &config))
+    {
+        free(samples);
+        return 1;
+    }
+
+    /* One pass for the report stream, then timed passes without output */
+    struct replay_metrics metrics;
+    FILE *out = NULL;
+
+    if (reports)
+    {
+        out = strcmp(reports, "-") ? fopen(reports, "w") : stdout;
+        if (!out)
+        {
+            perror(reports);
+            free(samples);
+            return 1;
+        }
+        fprintf(out, "time_us,wheel,pan\n");
+    }
+
+    if (scroll_replay_run(&config, samples, count, out ? write_report : NULL, out, &metrics))
+    {
+        fprintf(stderr, "replay failed, samples out of order or bad axis\n");
+        free(samples);
+        return 1;
+    }
+
+    if (out && out != stdout)
+    {
+        fclose(out);
+    }
+
+    struct replay_metrics timed;
+    double start = now_ns();
+
+    for (long run = 0; run < repeat; run++)
+    {
+        scroll_replay_run(&config, samples, count, NULL, NULL, &timed);
+    }
+
+    print_metrics(&config, &metrics, count ? (now_ns() - start) / ((double)repeat * count) : 0.0);
+
+    free(samples);
+
+    return 0;
+}